@@ -22,7 +22,10 @@
 
 #pragma once
 
+#include <bit>
 #include <mutex>
+#include <cstdint>
+#include "kls/coroutine/detail/CacheLine.h"
 #include "kls/thread/TSS.h"
 #include "kls/thread/SpinLock.h"
 #include "WorkStealingQueue.h"
@@ -37,6 +40,8 @@ namespace kls::coroutine::detail {
 
             Context *FinalizationAlternativeQueue{nullptr};
 
+            std::size_t Index{0}; // slot in the occupancy bitmap, fixed at creation
+
             bool Use() { return !mUsed.exchange(true); }
 
             void Reset() { mUsed.store(false); }
@@ -45,6 +50,9 @@ namespace kls::coroutine::detail {
             std::atomic_bool mUsed{false};
         };
 
+        static constexpr std::size_t StealBatch = 64;
+        // contexts past the bitmap capacity are still found by walking the list
+        static constexpr std::size_t BitmapWords = 16, BitmapSlots = BitmapWords * 64;
     public:
         ~BagQueue() {
             std::lock_guard lk{mLocalLock};
@@ -56,11 +64,16 @@ namespace kls::coroutine::detail {
             }
         }
 
-        void Add(const Task &item) { WriteContext()->push(item); }
+        void Add(const Task &item) {
+            const auto ctx = WriteContext();
+            ctx->push(item);
+            MarkOccupied(ctx);
+        }
 
         [[nodiscard]] Task Get() noexcept {
             const auto ctx = ReadContext();
             if (auto local = ctx->pop(); local) return *std::move(local);
+            MarkEmpty(ctx);
             if (mFinal) {
                 auto &alt = ctx->FinalizationAlternativeQueue;
                 for (;;) {
@@ -74,11 +87,25 @@ namespace kls::coroutine::detail {
             return Task{};
         }
 
+        // a set bit may be stale, but a context holding items always has its bit set
         bool SnapshotNotEmpty() noexcept {
-            for (auto it = mListHead.load(); it; it = it->Next) if (!it->empty()) return true;
+            for (auto &word: mOccupied) if (word.load(std::memory_order_seq_cst)) return true;
+            if (!mOverflow.load(std::memory_order_acquire)) return false;
+            for (auto it = mListHead.load(); it; it = it->Next) {
+                if (it->Index >= BitmapSlots && !it->empty()) return true;
+            }
             return false;
         }
 
+        // a reading thread gives its cached list back before it exits. left to the thread exit, the release could
+        // happen after the queue is gone
+        void Detach() noexcept {
+            auto &holder = Holder();
+            if (holder.Parent != this) return;
+            holder.Held->Reset();
+            holder.Parent = nullptr, holder.Held = nullptr;
+        }
+
         void Finalize() {
             {
                 // remove the tss storage for external threads to reset queue status
@@ -93,6 +120,11 @@ namespace kls::coroutine::detail {
         thread::SpinLock mLocalLock;
         std::atomic<Context *> mListHead = nullptr;
         Context *mListTail = nullptr;
+        std::size_t mNextIndex = 0;
+        std::atomic_bool mOverflow{false};
+        std::atomic<Context *> mSlots[BitmapSlots]{};
+        // one bit per context that may hold items. set on push, cleared lazily by whoever finds the context empty
+        alignas(CacheLine) std::atomic<std::uint64_t> mOccupied[BitmapWords]{};
         thread::Pointer<Context, void> mListTss{&LooseReset, nullptr};
 
         static void LooseReset(void *p, void *) noexcept { if (p) reinterpret_cast<Context *>(p)->Reset(); }
@@ -103,6 +135,9 @@ namespace kls::coroutine::detail {
             for (auto it = mListHead.load(); it; it = it->Next) if (it->Use()) return it;
             // add a new list if recycling failed
             const auto newList = new Context();
+            newList->Index = mNextIndex++;
+            if (newList->Index < BitmapSlots) mSlots[newList->Index].store(newList, std::memory_order_release);
+            else mOverflow.store(true, std::memory_order_release);
             if (mListTail) mListTail->Next = newList; else mListHead = newList;
             return (newList->Use(), mListTail = newList);
         }
@@ -120,16 +155,22 @@ namespace kls::coroutine::detail {
             return nullptr; // no queue is found
         }
 
+        struct ListHolder {
+            BagQueue *Parent{nullptr};
+            Context *Held{nullptr};
+
+            ~ListHolder() { if (Held) Held->Reset(); };
+        };
+
+        static ListHolder &Holder() {
+            static thread_local ListHolder holder;
+            return holder;
+        }
+
         // For use in executors, reading threads need to have list cached for maximum performance
         // We can avoid the expensive lookup by just using an id check
         static Context *ExecContext(BagQueue *parent, bool reading) {
-            struct ListHolder {
-                BagQueue *Parent{nullptr};
-                Context *Held{nullptr};
-
-                ~ListHolder() { if (Held) Held->Reset(); };
-            };
-            static thread_local ListHolder holder;
+            auto &holder = Holder();
             if (parent == holder.Parent) return holder.Held; // we have a unique list for this parent
             if (reading) { // assign a new list to the fast TLS cache
                 holder.Parent = parent;
@@ -147,10 +188,52 @@ namespace kls::coroutine::detail {
             return (mListTss.reset(newList), newList);
         }
 
+        static std::uint64_t Bit(const Context *ctx) noexcept { return std::uint64_t(1) << (ctx->Index % 64); }
+
+        void MarkOccupied(Context *ctx) noexcept {
+            if (ctx->Index >= BitmapSlots) return;
+            auto &word = mOccupied[ctx->Index / 64];
+            // orders the push before the check, pairs with the clear-then-recheck in MarkEmpty.
+            // the bit is usually set already, so the shared word is only written on the empty to busy transition
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!(word.load(std::memory_order_relaxed) & Bit(ctx))) word.fetch_or(Bit(ctx), std::memory_order_seq_cst);
+        }
+
+        // a push racing with this either sees the bit cleared and sets it again, or is seen by the re-check
+        void MarkEmpty(Context *ctx) noexcept {
+            if (ctx->Index >= BitmapSlots) return;
+            auto &word = mOccupied[ctx->Index / 64];
+            if (!(word.load(std::memory_order_relaxed) & Bit(ctx))) return;
+            word.fetch_and(~Bit(ctx), std::memory_order_seq_cst);
+            if (!ctx->empty()) word.fetch_or(Bit(ctx), std::memory_order_seq_cst);
+        }
+
+        // the thief takes up to half of the victim into its own queue, so a flooded queue is balanced out in a few
+        // rounds, without looking for a victim again for every single task
+        std::optional<Task> StealFrom(Context *ctx, Context *victim) {
+            if (!victim->steal_batch([ctx](Task &&t) { ctx->push(std::move(t)); }, StealBatch)) {
+                MarkEmpty(victim);
+                return std::nullopt;
+            }
+            MarkOccupied(ctx);
+            return ctx->pop();
+        }
+
+        // victims are picked from the set bits, a word at a time. thieves start at different words to spread out
         std::optional<Task> Steal(Context *ctx) {
+            const auto start = ctx->Index / 64 + ctx->Index % BitmapWords;
+            for (std::size_t i = 0; i < BitmapWords; ++i) {
+                const auto w = (start + i) % BitmapWords;
+                for (auto bits = mOccupied[w].load(std::memory_order_acquire); bits; bits &= bits - 1) {
+                    const auto victim = mSlots[w * 64 + std::countr_zero(bits)].load(std::memory_order_acquire);
+                    if (!victim || victim == ctx) continue;
+                    if (auto r = StealFrom(ctx, victim); r) return r;
+                }
+            }
+            if (!mOverflow.load(std::memory_order_acquire)) return std::nullopt;
             for (auto it = mListHead.load(); it; it = it->Next) {
-                if (it == ctx) continue;
-                if (auto r = it->steal(); r) return r;
+                if (it == ctx || it->Index < BitmapSlots) continue;
+                if (auto r = StealFrom(ctx, it); r) return r;
             }
             return std::nullopt;
         }
@@ -20,36 +20,92 @@
 * SOFTWARE.
 */
 
-#include "FifoQueue.h"
+#include <memory>
+#include <vector>
+#include "kls/coroutine/detail/FifoQueue.h"
 #include "Executor.hpp"
 #include "kls/thread/Semaphore.h"
 #include "kls/coroutine/Blocking.h"
 
 namespace kls::coroutine::detail {
+    // a task run by a helping thread may block on run_blocking again, and helping once more would stack its wait
+    // on top of the one below, which it may well depend on. past this depth the call waits on its own executor
+    // inside a blocking section instead, so the pool stands in for the thread
+    static constexpr int max_help_depth = 4;
+    static thread_local int gHelpDepth{ 0 };
+
     class Blocking::Executor final : public IExecutor {
     public:
-        Executor() :
-            IExecutor(static_cast<FnEnqueue>(&Executor::EnqueueRawImpl)),
-            mRunning(true) {
-            detail::SetCurrentExecutor(this);
+        Executor() : IExecutor(
+                static_cast<FnEnqueue>(&Executor::EnqueueRawImpl), static_cast<FnEnqueueNode>(&Executor::EnqueueNodeImpl)
+        ) {}
+
+        // executors are kept per thread and reused by later calls. nested calls take one each
+        static Executor* Acquire() {
+            auto& idle = Idle();
+            if (idle.empty()) return new Executor();
+            const auto exec = idle.back().release();
+            return (idle.pop_back(), exec);
+        }
+
+        static void Release(Executor* exec) { Idle().emplace_back(exec); }
+
+        // when called on a worker of a helpable executor, the blocked thread keeps running that executor's
+        // queue instead of idling, and the awaited task is resumed there as well
+        void Enter() noexcept {
+            mRunning = true;
+            mPrevious = this_executor();
+            mDeadline = this_deadline();
+            mHelp = gHelpDepth < max_help_depth ? CurrentHelpable() : nullptr;
+            if (!mHelp) SetCurrentExecutor(this);
         }
 
+        // the tasks run in between leave their executor and deadline on the thread, the caller gets its own back
         void Start() {
+            if (mHelp) Help(); else Own();
+            SetCurrentExecutor(mPrevious);
+            SetCurrentDeadline(mDeadline);
+        }
+
+        void Stop() noexcept {
+            mRunning = false;
+            // in helping mode the stop may come from any worker while this thread is parked
+            if (mHelp) mHelpPark.wake();
+        }
+
+    private:
+        void Own() {
+            BlockingSection section{};
             while (mRunning) {
                 DoWorks();
                 if (mRunning) Rest();
             }
-            detail::SetCurrentExecutor(nullptr);
         }
 
-        void Stop() noexcept { mRunning = false; }
+        void Help() {
+            ++gHelpDepth;
+            while (mRunning) {
+                if (mHelp->help_once()) continue;
+                // the pool is empty, but other workers may still be busy with what we are waiting for. the
+                // park is woken by the pool queueing more work, or by Stop
+                mHelpPark.arm();
+                const auto queued = mHelp->park(mHelpPark, true);
+                if (!(queued || !mRunning) || !mHelpPark.claim()) mHelpPark.wait();
+                mHelp->park(mHelpPark, false);
+            }
+            --gHelpDepth;
+        }
 
-    private:
         void EnqueueRawImpl(void* handle) noexcept {
             mQueue.Add(handle);
             WakeOne();
         }
 
+        void EnqueueNodeImpl(TaskNode* node) noexcept {
+            mQueue.Link(node);
+            WakeOne();
+        }
+
         void WakeOne() noexcept {
             for (;;) {
                 if (auto c = mPark.load(); c) {
@@ -72,20 +128,44 @@ namespace kls::coroutine::detail {
         }
 
         void DoWorks() noexcept {
-            for (;;) if (auto exec = mQueue.Get(); exec) std::coroutine_handle<>::from_address(exec).resume(); else return;
+            for (detail::TaskTrace trace{};;) {
+                if (auto exec = mQueue.Get(trace); exec) detail::ResumeTask(exec, trace); else return;
+            }
         }
 
-        std::atomic_bool mRunning;
+        std::atomic_bool mRunning{ false };
+        IExecutor* mPrevious{ nullptr };
+        Deadline mDeadline{ Deadline::max() };
+        IHelpable* mHelp{ nullptr };
+        HelperPark mHelpPark{};
         detail::FifoQueue<void*, true> mQueue;
         std::atomic_int mPark{ 0 };
         thread::Semaphore mSignal{};
+
+        static std::vector<std::unique_ptr<Executor>>& Idle() {
+            static thread_local std::vector<std::unique_ptr<Executor>> idle{};
+            return idle;
+        }
     };
 
-    Blocking::Blocking() : mTheExec(new Executor()) {}
+    Blocking::Blocking() : mTheExec(Executor::Acquire()) { mTheExec->Enter(); }
 
-    Blocking::~Blocking() { delete mTheExec; }
+    Blocking::~Blocking() { Executor::Release(mTheExec); }
 
     void Blocking::start() { mTheExec->Start(); }
 
     void Blocking::stop() { mTheExec->Stop(); }
 }
+
+namespace kls::coroutine {
+    static thread_local int gSections{ 0 };
+
+    BlockingSection::BlockingSection() noexcept : mPool(gSections++ ? nullptr : detail::CurrentHelpable()) {
+        if (mPool) mPool->blocking(true);
+    }
+
+    BlockingSection::~BlockingSection() noexcept {
+        --gSections;
+        if (mPool) mPool->blocking(false);
+    }
+}
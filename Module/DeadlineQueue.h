@@ -0,0 +1,165 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "kls/coroutine/detail/CacheLine.h"
+#include "Executor.hpp"
+#include "kls/thread/SpinLock.h"
+
+namespace kls::coroutine::detail {
+    // earliest-deadline-first queue. every thread pushes into its own shard, and a reader pops from whichever
+    // shard currently advertises the earliest head, so the earliest entries are stolen first.
+    // the deadline of an entry is the one of the enqueuing thread (see IExecutor::enqueue), and Get makes the
+    // deadline of the returned entry current, so whatever it enqueues while running inherits it.
+    template<class Task>
+    class DeadlineQueue {
+        struct Item {
+            Deadline When;
+            std::uint64_t Seq;
+            Task Value;
+        };
+
+        // heap order, so the 'greatest' item is the earliest one. equal deadlines run in push order
+        struct Later {
+            bool operator()(const Item &l, const Item &r) const noexcept {
+                return l.When != r.When ? l.When > r.When : l.Seq > r.Seq;
+            }
+        };
+
+        struct alignas(CacheLine) Shard {
+            thread::SpinLock Lock{};
+            std::uint64_t Seq{0};
+            std::vector<Item> Heap{};
+            std::deque<Item> Late{};
+            // published without the lock for the pick heuristic, the pop itself is always checked under the lock
+            std::atomic<Deadline::rep> Head{Deadline::max().time_since_epoch().count()};
+            std::atomic_size_t Ready{0}, Expired{0};
+
+            void Publish() noexcept {
+                if (!Heap.empty()) Head.store(Heap.front().When.time_since_epoch().count(), std::memory_order_relaxed);
+                Ready.store(Heap.size(), std::memory_order_relaxed);
+                Expired.store(Late.size(), std::memory_order_relaxed);
+            }
+        };
+    public:
+        // tells the executor to pass explicit deadlines on through this_deadline()
+        static constexpr bool ByDeadline = true;
+
+        explicit DeadlineQueue(bool demote = true) :
+                mDemote(demote), mCount(std::max(1u, std::thread::hardware_concurrency())),
+                mShards(new Shard[mCount]) {}
+
+        void Add(const Task &t) {
+            auto &s = mShards[LocalShard()];
+            std::lock_guard lk{s.Lock};
+            s.Heap.push_back(Item{this_deadline(), s.Seq++, t});
+            std::push_heap(s.Heap.begin(), s.Heap.end(), Later{});
+            s.Publish();
+        }
+
+        [[nodiscard]] Task Get() noexcept {
+            const auto local = LocalShard();
+            const auto now = mDemote ? std::chrono::steady_clock::now() : Deadline::min();
+            for (auto pick = Pick(local); pick != mCount; pick = Pick(local)) {
+                if (auto task = PopOnTime(mShards[pick], now); task) return task;
+            }
+            // nothing on time is ready, serve the late lanes starting from the local one
+            for (std::size_t i = 0; i < mCount; ++i) {
+                if (auto task = PopLate(mShards[(local + i) % mCount]); task) return task;
+            }
+            SetCurrentDeadline(Deadline::max());
+            return Task{};
+        }
+
+        [[nodiscard]] bool SnapshotNotEmpty() const noexcept {
+            for (std::size_t i = 0; i < mCount; ++i) {
+                const auto &s = mShards[i];
+                if (s.Ready.load(std::memory_order_relaxed) || s.Expired.load(std::memory_order_relaxed)) return true;
+            }
+            return false;
+        }
+
+        void Finalize() noexcept {}
+
+        void Detach() noexcept {}
+    private:
+        const bool mDemote;
+        const std::size_t mCount;
+        std::unique_ptr<Shard[]> mShards;
+
+        std::size_t LocalShard() const noexcept {
+            static std::atomic_size_t next{0};
+            static thread_local const auto slot = next.fetch_add(1, std::memory_order_relaxed);
+            return slot % mCount;
+        }
+
+        // the shard with the earliest advertised head. scanning starts at the local shard so it wins ties
+        std::size_t Pick(std::size_t local) const noexcept {
+            auto best = mCount;
+            auto head = Deadline::rep{};
+            for (std::size_t i = 0; i < mCount; ++i) {
+                const auto at = (local + i) % mCount;
+                const auto &s = mShards[at];
+                if (!s.Ready.load(std::memory_order_relaxed)) continue;
+                const auto h = s.Head.load(std::memory_order_relaxed);
+                if (best == mCount || h < head) best = at, head = h;
+            }
+            return best;
+        }
+
+        Task PopOnTime(Shard &s, Deadline now) noexcept {
+            std::lock_guard lk{s.Lock};
+            while (!s.Heap.empty()) {
+                std::pop_heap(s.Heap.begin(), s.Heap.end(), Later{});
+                auto item = s.Heap.back();
+                s.Heap.pop_back();
+                // deadline already missed, move it out of the way of work that can still make it
+                if (item.When < now) { s.Late.push_back(item); continue; }
+                s.Publish();
+                SetCurrentDeadline(item.When);
+                return item.Value;
+            }
+            s.Publish();
+            return Task{};
+        }
+
+        Task PopLate(Shard &s) noexcept {
+            if (!s.Expired.load(std::memory_order_relaxed)) return Task{};
+            std::lock_guard lk{s.Lock};
+            if (s.Late.empty()) return Task{};
+            auto item = s.Late.front();
+            s.Late.pop_front();
+            s.Publish();
+            SetCurrentDeadline(item.When);
+            return item.Value;
+        }
+    };
+}
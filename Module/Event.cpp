@@ -0,0 +1,114 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <bit>
+#include <mutex>
+#include <cassert>
+#include "kls/coroutine/Event.h"
+
+using namespace kls::coroutine;
+
+static void *const SET_PTR = std::bit_cast<void *>(~uintptr_t(0));
+
+// the event is already complete, continue directly or move over to the executor of the waiter
+static bool pass(FifoExecutorAwaitEntry &entry) {
+    if (entry.resumable_inplace(this_executor())) return false;
+    return (entry.resume_async(), true);
+}
+
+// waiters are pushed at the front, reverse the list before resuming so that they run in arrival order
+static void resume_all(FifoExecutorAwaitEntry *it) {
+    FifoExecutorAwaitEntry *fifo = nullptr;
+    while (it) {
+        const auto next = it->get_next();
+        it->set_next(fifo);
+        fifo = it;
+        it = next;
+    }
+    while (fifo) {
+        const auto current = fifo;
+        fifo = fifo->get_next();
+        current->resume_async(); // expect this to invalidate the current pointer
+    }
+}
+
+AsyncEvent::AsyncEvent(bool set) noexcept: m_state(set ? SET_PTR : nullptr) {}
+
+AsyncEvent::~AsyncEvent() {
+    [[maybe_unused]] const auto state = m_state.load(std::memory_order_relaxed);
+    assert(state == nullptr || state == SET_PTR);
+}
+
+bool AsyncEvent::ready() const noexcept { return m_state.load(std::memory_order_acquire) == SET_PTR; }
+
+bool AsyncEvent::trap(FifoExecutorAwaitEntry &entry) {
+    auto state = m_state.load(std::memory_order_acquire);
+    for (;;) {
+        if (state == SET_PTR) return pass(entry);
+        entry.set_next(static_cast<FifoExecutorAwaitEntry *>(state));
+        if (m_state.compare_exchange_weak(state, &entry, std::memory_order_release, std::memory_order_acquire))
+            return true;
+    }
+}
+
+void AsyncEvent::set() {
+    const auto state = m_state.exchange(SET_PTR, std::memory_order_acq_rel);
+    if (state != SET_PTR) resume_all(static_cast<FifoExecutorAwaitEntry *>(state));
+}
+
+void AsyncEvent::reset() noexcept {
+    auto state = SET_PTR;
+    m_state.compare_exchange_strong(state, nullptr, std::memory_order_relaxed);
+}
+
+bool WaitGroup::trap(FifoExecutorAwaitEntry &entry) {
+    {
+        std::lock_guard lk{m_lock};
+        // the counter is checked under the lock, so a release running after a drop to zero will see this entry
+        if (m_count.load() != 0) return (entry.set_next(m_head), m_head = &entry, true);
+    }
+    return pass(entry);
+}
+
+void WaitGroup::release() {
+    FifoExecutorAwaitEntry *head;
+    {
+        std::lock_guard lk{m_lock};
+        // the group might have been raised again before we got here, in which case the waiters stay
+        if (m_count.load() != 0) return;
+        head = std::exchange(m_head, nullptr);
+    }
+    resume_all(head);
+}
+
+bool Barrier::trap(FifoExecutorAwaitEntry &entry) {
+    FifoExecutorAwaitEntry *head;
+    {
+        std::lock_guard lk{m_lock};
+        if (--m_remaining != 0) return (entry.set_next(m_head), m_head = &entry, true);
+        // last one to arrive, start the next phase and take the waiters of this one with us
+        m_remaining = m_parties;
+        head = std::exchange(m_head, nullptr);
+    }
+    resume_all(head);
+    return false;
+}
@@ -20,32 +20,88 @@
 * SOFTWARE.
 */
 
-#include "FifoQueue.h"
+#include "kls/coroutine/Latency.h"
+#include "kls/coroutine/detail/FifoQueue.h"
 #include "Executor.hpp"
 
 namespace kls::coroutine::detail {
 	static thread_local IExecutor* gExecutor{ nullptr };
+	static thread_local Deadline gDeadline{ Deadline::max() };
+	static thread_local IHelpable* gHelpable{ nullptr };
 
 	void SetCurrentExecutor(IExecutor* exec) noexcept { gExecutor = exec; }
+
+	void SetCurrentDeadline(Deadline deadline) noexcept { gDeadline = deadline; }
+
+	IHelpable* CurrentHelpable() noexcept { return gHelpable; }
+
+	void SetCurrentHelpable(IHelpable* exec) noexcept { gHelpable = exec; }
 }
 
 namespace kls::coroutine {
 	IExecutor* this_executor() noexcept { return detail::gExecutor; }
 
+	Deadline this_deadline() noexcept { return detail::gDeadline; }
+
+	void IExecutor::EnqueueAt(std::coroutine_handle<> handle, Deadline deadline) noexcept {
+		// the deadline executor reads the deadline of the enqueuing thread, so swap it in for the call
+		const auto last = std::exchange(detail::gDeadline, deadline);
+		enqueue(handle);
+		detail::gDeadline = last;
+	}
+
+	void IExecutor::enqueue(TaskNode& node, std::coroutine_handle<> handle, Deadline deadline) noexcept {
+		assert(handle);
+		node.next = nullptr, node.handle = handle.address(), node.queued = detail::QueueStamp();
+		// the executor is not touched after the task is queued, it may be gone by the time the call returns
+		const auto post = [&]() noexcept {
+			if (EnqueueNode) (*this.*EnqueueNode)(&node); else (*this.*EnqueueRaw)(detail::TracedTask(node));
+		};
+		if (!ByDeadline) return post();
+		const auto last = std::exchange(detail::gDeadline, deadline);
+		post();
+		detail::gDeadline = last;
+	}
+
+	LatencyRecorder& IExecutor::latency() {
+		if (const auto recorder = latency_recorder(); recorder) return *recorder;
+		auto created = std::make_unique<LatencyRecorder>();
+		LatencyRecorder* expected = nullptr;
+		// the first of racing callers installs its recorder, the others use that one
+		if (!mLatency.compare_exchange_strong(expected, created.get(), std::memory_order_acq_rel)) return *expected;
+		created->enable(true);
+		return *created.release();
+	}
+
+	IExecutor::~IExecutor() noexcept { delete mLatency.load(std::memory_order_relaxed); }
+
     class ManualDrainExecutor::Executor final : public IExecutor {
     public:
-        Executor() : IExecutor(static_cast<FnEnqueue>(&Executor::EnqueueRawImpl)) {}
+        Executor() : IExecutor(
+                static_cast<FnEnqueue>(&Executor::EnqueueRawImpl), static_cast<FnEnqueueNode>(&Executor::EnqueueNodeImpl)
+        ) {}
 
-        void DrainOnce() {
+        // Stop is asked before every task with the number of tasks run so far
+        template<class Stop>
+        DrainResult Drain(Stop stop) {
+            const auto previous = this_executor();
             detail::SetCurrentExecutor(this);
-            for (;;) if (auto exec = mQueue.Get(); exec) std::coroutine_handle<>::from_address(exec).resume(); else return;
-            detail::SetCurrentExecutor(nullptr);
+            std::size_t ran = 0;
+            while (!stop(ran)) {
+                detail::TaskTrace trace{};
+                if (auto exec = mQueue.Get(trace); exec) detail::ResumeTask(exec, trace); else break;
+                ++ran;
+            }
+            detail::SetCurrentExecutor(previous);
+            return DrainResult{ ran, mQueue.SnapshotNotEmpty() };
         }
     private:
         void EnqueueRawImpl(void* handle) noexcept {
             mQueue.Add(handle);
         }
 
+        void EnqueueNodeImpl(TaskNode* node) noexcept { mQueue.Link(node); }
+
         detail::FifoQueue<void*, true> mQueue;
     };
 
@@ -53,6 +109,15 @@ namespace kls::coroutine {
 
     ManualDrainExecutor::~ManualDrainExecutor() { delete mTheExec; }
 
-    void ManualDrainExecutor::drain_once() { mTheExec->DrainOnce(); }
-}
+    IExecutor* ManualDrainExecutor::executor() const noexcept { return mTheExec; }
 
+    void ManualDrainExecutor::drain_once() { mTheExec->Drain([](std::size_t) noexcept { return false; }); }
+
+    ManualDrainExecutor::DrainResult ManualDrainExecutor::drain_until(Deadline deadline) {
+        return mTheExec->Drain([deadline](std::size_t) noexcept { return std::chrono::steady_clock::now() >= deadline; });
+    }
+
+    ManualDrainExecutor::DrainResult ManualDrainExecutor::drain_n(std::size_t count) {
+        return mTheExec->Drain([count](std::size_t ran) noexcept { return ran >= count; });
+    }
+}
@@ -20,8 +20,20 @@
 * SOFTWARE.
 */
 
-#include "kls/coroutine/Executor.h"
+#pragma once
+
+#include "kls/coroutine/detail/Worker.h"
 
 namespace kls::coroutine::detail {
-	void SetCurrentExecutor(IExecutor* exec) noexcept;
+	void SetCurrentDeadline(Deadline deadline) noexcept;
+
+	// counts profiling and enabled latency recorders in or out of the users of QueueStamp
+	void AddStamping(int delta) noexcept;
+
+	IHelpable* CurrentHelpable() noexcept;
+
+	// what a queue holding bare handles takes for a filled in node, so the task still runs under the node's tag
+	// and is accounted with its stamp. ResumeTask tells the two apart, a plain handle is passed on if there is
+	// nothing to carry
+	void* TracedTask(TaskNode& node) noexcept;
 }
@@ -0,0 +1,414 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cerrno>
+#include <utility>
+#include <algorithm>
+#include <exception>
+#include <system_error>
+#include <unordered_map>
+#include "Platform.h"
+#include "kls/coroutine/File.h"
+#include "kls/coroutine/Scaling.h"
+#include "kls/coroutine/Operation.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+namespace kls::coroutine::detail {
+#if defined(_WIN32)
+    static HANDLE Native(std::intptr_t handle) noexcept { return reinterpret_cast<HANDLE>(handle); }
+
+    [[noreturn]] static void Fail(const char *what) {
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), what);
+    }
+
+    static std::intptr_t OpenFile(const std::filesystem::path &path, FileMode mode) {
+        DWORD access = GENERIC_READ, disposition = OPEN_EXISTING;
+        if (mode == FileMode::Write) access = GENERIC_WRITE, disposition = CREATE_ALWAYS;
+        if (mode == FileMode::Update) access = GENERIC_READ | GENERIC_WRITE, disposition = OPEN_ALWAYS;
+        const auto share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+        const auto handle = CreateFileW(path.c_str(), access, share, nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) Fail("CreateFileW");
+        return reinterpret_cast<std::intptr_t>(handle);
+    }
+
+    static void CloseFile(std::intptr_t handle) noexcept { CloseHandle(Native(handle)); }
+
+    // a synchronous handle still reads and writes at the position given by the OVERLAPPED
+    static OVERLAPPED At(std::uint64_t offset) noexcept {
+        OVERLAPPED at{};
+        at.Offset = static_cast<DWORD>(offset), at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        return at;
+    }
+
+    static DWORD Piece(std::size_t left) noexcept { return static_cast<DWORD>(std::min<std::size_t>(left, 1u << 30)); }
+
+    static std::size_t ReadAt(std::intptr_t handle, std::uint64_t offset, std::span<std::byte> buffer) {
+        std::size_t done = 0;
+        while (done < buffer.size()) {
+            DWORD got = 0;
+            auto at = At(offset + done);
+            if (!ReadFile(Native(handle), buffer.data() + done, Piece(buffer.size() - done), &got, &at)) {
+                if (GetLastError() == ERROR_HANDLE_EOF) break;
+                Fail("ReadFile");
+            }
+            if (!got) break;
+            done += got;
+        }
+        return done;
+    }
+
+    static void WriteAt(std::intptr_t handle, std::uint64_t offset, std::span<const std::byte> data) {
+        for (std::size_t done = 0; done < data.size();) {
+            DWORD put = 0;
+            auto at = At(offset + done);
+            if (!WriteFile(Native(handle), data.data() + done, Piece(data.size() - done), &put, &at)) Fail("WriteFile");
+            done += put;
+        }
+    }
+
+    static void SyncFile(std::intptr_t handle) { if (!FlushFileBuffers(Native(handle))) Fail("FlushFileBuffers"); }
+
+    static std::uint64_t FileSize(std::intptr_t handle) {
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(Native(handle), &size)) Fail("GetFileSizeEx");
+        return static_cast<std::uint64_t>(size.QuadPart);
+    }
+#else
+    [[noreturn]] static void Fail(const char *what) { throw std::system_error(errno, std::system_category(), what); }
+
+    static std::intptr_t OpenFile(const std::filesystem::path &path, FileMode mode) {
+        int flags = O_RDONLY;
+        if (mode == FileMode::Write) flags = O_WRONLY | O_CREAT | O_TRUNC;
+        if (mode == FileMode::Update) flags = O_RDWR | O_CREAT;
+        const auto fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (fd < 0) Fail("open");
+        return fd;
+    }
+
+    static void CloseFile(std::intptr_t handle) noexcept { ::close(static_cast<int>(handle)); }
+
+    static std::size_t ReadAt(std::intptr_t handle, std::uint64_t offset, std::span<std::byte> buffer) {
+        std::size_t done = 0;
+        while (done < buffer.size()) {
+            const auto got = ::pread(static_cast<int>(handle), buffer.data() + done, buffer.size() - done, off_t(offset + done));
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) Fail("pread");
+            if (!got) break;
+            done += static_cast<std::size_t>(got);
+        }
+        return done;
+    }
+
+    static void WriteAt(std::intptr_t handle, std::uint64_t offset, std::span<const std::byte> data) {
+        for (std::size_t done = 0; done < data.size();) {
+            const auto put = ::pwrite(static_cast<int>(handle), data.data() + done, data.size() - done, off_t(offset + done));
+            if (put < 0 && errno == EINTR) continue;
+            if (put < 0) Fail("pwrite");
+            done += static_cast<std::size_t>(put);
+        }
+    }
+
+    static void SyncFile(std::intptr_t handle) { if (::fsync(static_cast<int>(handle))) Fail("fsync"); }
+
+    static std::uint64_t FileSize(std::intptr_t handle) {
+        struct stat info{};
+        if (::fstat(static_cast<int>(handle), &info)) Fail("fstat");
+        return static_cast<std::uint64_t>(info.st_size);
+    }
+#endif
+
+    struct FileAccess {
+        static std::intptr_t Handle(const File &file) noexcept { return file.mHandle; }
+    };
+
+    // a read-only view of a whole file
+    class Mapping {
+    public:
+        Mapping() noexcept = default;
+
+        explicit Mapping(std::intptr_t handle): mSize(static_cast<std::size_t>(FileSize(handle))) {
+            if (!mSize) return;
+#if defined(_WIN32)
+            const auto map = CreateFileMappingW(Native(handle), nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!map) Fail("CreateFileMappingW");
+            mData = static_cast<const std::byte *>(MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(map); // the view keeps the mapping alive
+            if (!mData) Fail("MapViewOfFile");
+#else
+            const auto view = ::mmap(nullptr, mSize, PROT_READ, MAP_SHARED, static_cast<int>(handle), 0);
+            if (view == MAP_FAILED) Fail("mmap");
+            mData = static_cast<const std::byte *>(view);
+            ::posix_madvise(view, mSize, POSIX_MADV_SEQUENTIAL);
+#endif
+        }
+
+        Mapping(Mapping &&other) noexcept:
+                mData(std::exchange(other.mData, nullptr)), mSize(std::exchange(other.mSize, 0)) {}
+
+        Mapping &operator=(Mapping &&other) noexcept {
+            if (this != &other) std::destroy_at(this), std::construct_at(this, std::move(other));
+            return *this;
+        }
+
+        ~Mapping() noexcept {
+            if (!mData) return;
+#if defined(_WIN32)
+            UnmapViewOfFile(mData);
+#else
+            ::munmap(const_cast<std::byte *>(mData), mSize);
+#endif
+        }
+
+        [[nodiscard]] const std::byte *data() const noexcept { return mData; }
+
+        [[nodiscard]] std::size_t size() const noexcept { return mSize; }
+
+        // asks the kernel to start paging in the range without waiting for it
+        void prefetch(std::size_t offset, std::size_t length) const noexcept {
+            if (offset >= mSize) return;
+            length = std::min(length, mSize - offset);
+#if defined(_WIN32) && _WIN32_WINNT >= 0x0602
+            WIN32_MEMORY_RANGE_ENTRY range{const_cast<std::byte *>(mData + offset), length};
+            PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#elif !defined(_WIN32)
+            static const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            const auto begin = offset / page * page;
+            ::posix_madvise(const_cast<std::byte *>(mData + begin), offset + length - begin, POSIX_MADV_WILLNEED);
+#endif
+        }
+
+    private:
+        const std::byte *mData{nullptr};
+        std::size_t mSize{0};
+    };
+
+    // buffers of stream reads, kept for later streams reading chunks of the same size
+    class BufferPool {
+    public:
+        static BufferPool &Get() {
+            static BufferPool instance{};
+            return instance;
+        }
+
+        std::unique_ptr<std::byte[]> Acquire(std::size_t size) {
+            {
+                std::lock_guard lk{mLock};
+                if (auto &free = mFree[size]; !free.empty()) {
+                    auto buffer = std::move(free.back());
+                    free.pop_back();
+                    mKept -= size;
+                    return buffer;
+                }
+            }
+            return std::make_unique_for_overwrite<std::byte[]>(size);
+        }
+
+        void Release(std::size_t size, std::unique_ptr<std::byte[]> buffer) {
+            std::lock_guard lk{mLock};
+            if (mKept + size > Limit) return;
+            mKept += size;
+            mFree[size].push_back(std::move(buffer));
+        }
+
+    private:
+        // bytes kept while no stream uses them
+        static constexpr std::size_t Limit = std::size_t(64) << 20;
+        std::mutex mLock{};
+        std::unordered_map<std::size_t, std::vector<std::unique_ptr<std::byte[]>>> mFree{};
+        std::size_t mKept{0};
+    };
+
+    // the buffers of one stream, given back to the pool when it ends
+    class StreamBuffers {
+    public:
+        StreamBuffers(std::size_t size, std::size_t count): mSize(size) {
+            for (std::size_t i = 0; i < count; ++i) mBuffers.push_back(BufferPool::Get().Acquire(size));
+        }
+
+        ~StreamBuffers() { for (auto &&buffer: mBuffers) BufferPool::Get().Release(mSize, std::move(buffer)); }
+
+        std::byte *operator[](std::size_t i) const noexcept { return mBuffers[i % mBuffers.size()].get(); }
+
+    private:
+        std::size_t mSize;
+        std::vector<std::unique_ptr<std::byte[]>> mBuffers{};
+    };
+
+    // every queued operation means that all file threads are blocked in a call, so the pool grows right away
+    class FilePolicy : public IScalingPolicy {
+    public:
+        FilePolicy() noexcept: IScalingPolicy(
+                static_cast<FnDecide>(&FilePolicy::DecideImpl), static_cast<FnRecord>(&FilePolicy::RecordImpl)
+        ) {}
+
+    private:
+        ScalingDecision DecideImpl(const ScalingSample &sample) noexcept {
+            return sample.reason == ScalingSample::Reason::Idle ? ScalingDecision::Retire : ScalingDecision::Spawn;
+        }
+
+        void RecordImpl(const ScalingEvent &) noexcept {}
+    };
+
+    static ValueAsync<Mapping> MapFile(std::intptr_t handle) {
+        co_await SwitchTo(file_executor());
+        co_return Mapping(handle);
+    }
+
+    static ValueAsync<void> Settle(ValueAsync<std::size_t> read) {
+        try { co_await std::move(read); } catch (...) {}
+    }
+
+    static AsyncGenerator<std::span<const std::byte>> ReadMapped(
+            const File &file, ReadStreamOptions options, const std::atomic_bool *stop
+    ) {
+        const auto mapping = co_await MapFile(FileAccess::Handle(file));
+        for (auto at = options.offset; at < mapping.size() && !*stop; at += options.chunk) {
+            const auto length = std::min<std::size_t>(options.chunk, mapping.size() - at);
+            mapping.prefetch(at + length, options.chunk * options.depth);
+            co_yield std::span<const std::byte>(mapping.data() + at, length);
+        }
+    }
+
+    static AsyncGenerator<std::span<const std::byte>> ReadBuffered(
+            const File &file, ReadStreamOptions options, const std::atomic_bool *stop
+    ) {
+        struct Pending {
+            ValueAsync<std::size_t> read;
+            std::byte *data;
+        };
+        const auto end = co_await file.size();
+        // one buffer is out with the consumer while depth reads fill the others
+        const StreamBuffers buffers{options.chunk, options.depth + 1};
+        std::deque<Pending> pending{};
+        std::size_t slot = 0;
+        auto next = options.offset;
+        const auto fill = [&] {
+            for (; pending.size() < options.depth && next < end; next += options.chunk) {
+                const auto data = buffers[slot++];
+                pending.push_back({file.read_at(next, {data, options.chunk}), data});
+            }
+        };
+        for (fill(); !pending.empty() && !*stop;) {
+            auto [read, data] = std::move(pending.front());
+            pending.pop_front();
+            // the buffer the consumer just gave back is the one taken next
+            fill();
+            std::size_t length = 0;
+            std::exception_ptr error{};
+            try { length = co_await std::move(read); } catch (...) { error = std::current_exception(); }
+            if (error) {
+                // reads still in flight write into the buffers, which have to outlive them
+                for (auto &&rest: pending) co_await Settle(std::move(rest.read));
+                std::rethrow_exception(error);
+            }
+            if (length) co_yield std::span<const std::byte>(data, length); else next = end; // the file shrank
+        }
+        // a dropped stream ends here with reads in flight
+        for (auto &&rest: pending) co_await Settle(std::move(rest.read));
+    }
+
+    // runs a dropped stream to its end. the stop flag is kept alive here until the producer is done with it
+    static ValueAsync<void> Abandon(
+            AsyncGenerator<std::span<const std::byte>> items, std::unique_ptr<std::atomic_bool> stop
+    ) {
+        try {
+            for (bool more = true; more;) more = co_await items.forward();
+        } catch (...) {}
+    }
+}
+
+namespace kls::coroutine {
+    IExecutor *file_executor() {
+        static const auto pool = CreateScalingFIFOExecutor(
+                {0, 16, std::chrono::seconds(2)}, std::make_shared<detail::FilePolicy>()
+        );
+        return pool->executor();
+    }
+
+    File::File(File &&other) noexcept: mHandle(std::exchange(other.mHandle, -1)) {}
+
+    File &File::operator=(File &&other) noexcept {
+        if (this != &other) {
+            if (is_open()) detail::CloseFile(mHandle);
+            mHandle = std::exchange(other.mHandle, -1);
+        }
+        return *this;
+    }
+
+    File::~File() noexcept { if (is_open()) detail::CloseFile(mHandle); }
+
+    ValueAsync<File> File::open(std::filesystem::path path, FileMode mode) {
+        co_await SwitchTo(file_executor());
+        co_return File(detail::OpenFile(path, mode));
+    }
+
+    ValueAsync<std::size_t> File::read_at(std::uint64_t offset, std::span<std::byte> buffer) const {
+        const auto handle = mHandle;
+        co_await SwitchTo(file_executor());
+        co_return detail::ReadAt(handle, offset, buffer);
+    }
+
+    ValueAsync<std::size_t> File::write_at(std::uint64_t offset, std::span<const std::byte> data) const {
+        const auto handle = mHandle;
+        co_await SwitchTo(file_executor());
+        detail::WriteAt(handle, offset, data);
+        co_return data.size();
+    }
+
+    ValueAsync<void> File::fsync() const {
+        const auto handle = mHandle;
+        co_await SwitchTo(file_executor());
+        detail::SyncFile(handle);
+    }
+
+    ValueAsync<std::uint64_t> File::size() const {
+        const auto handle = mHandle;
+        co_await SwitchTo(file_executor());
+        co_return detail::FileSize(handle);
+    }
+
+    ReadStream::~ReadStream() noexcept {
+        if (!m_stop) return;
+        *m_stop = true;
+        detail::Abandon(m_items, std::move(m_stop));
+    }
+
+    ReadStream read_stream(const File &file, ReadStreamOptions options) {
+        options.chunk = std::max<std::size_t>(options.chunk, 1);
+        options.depth = std::max<std::size_t>(options.depth, 1);
+        auto stop = std::make_unique<std::atomic_bool>(false);
+        const auto flag = stop.get();
+        if (options.mapped) return {detail::ReadMapped(file, options, flag), std::move(stop)};
+        return {detail::ReadBuffered(file, options, flag), std::move(stop)};
+    }
+}
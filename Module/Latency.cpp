@@ -0,0 +1,153 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <bit>
+#include <cmath>
+#include <thread>
+#include <algorithm>
+#include "kls/coroutine/Latency.h"
+#include "kls/coroutine/detail/CacheLine.h"
+#include "Executor.hpp"
+
+namespace kls::coroutine {
+    static constexpr int SubCount = 1 << LatencyHistogram::SubBits;
+    static constexpr int HalfCount = SubCount / 2;
+
+    LatencyHistogram::LatencyHistogram() : mCounts(Buckets) {}
+
+    // values below SubCount get a bucket each. above that every power of two is split into HalfCount buckets,
+    // which keeps the width of a bucket within 1/HalfCount of the values it holds
+    int LatencyHistogram::BucketOf(std::int64_t value) noexcept {
+        if (value < SubCount) return value < 0 ? 0 : int(value);
+        const auto v = std::min(std::uint64_t(value), (std::uint64_t(1) << MaxBits) - 1);
+        const auto top = int(std::bit_width(v)) - 1;
+        const auto shift = top - SubBits + 1;
+        return SubCount + (top - SubBits) * HalfCount + int(v >> shift) - HalfCount;
+    }
+
+    std::int64_t LatencyHistogram::BucketTop(int bucket) noexcept {
+        if (bucket < SubCount) return bucket;
+        const auto shift = (bucket - SubCount) / HalfCount + 1;
+        const auto sub = std::int64_t((bucket - SubCount) % HalfCount + HalfCount);
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::Add(int bucket, std::uint64_t count) noexcept {
+        mCounts[bucket] += count;
+        mCount += count;
+    }
+
+    void LatencyHistogram::AddTotals(std::int64_t sum, std::int64_t max) noexcept {
+        mSum += sum;
+        mMax = std::max(mMax, max);
+    }
+
+    void LatencyHistogram::record(std::chrono::nanoseconds value) noexcept {
+        const auto v = std::max<std::int64_t>(value.count(), 0);
+        Add(BucketOf(v), 1);
+        AddTotals(v, v);
+    }
+
+    void LatencyHistogram::merge(const LatencyHistogram& other) noexcept {
+        for (int i = 0; i < Buckets; ++i) if (other.mCounts[i]) Add(i, other.mCounts[i]);
+        AddTotals(other.mSum, other.mMax);
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::mean() const noexcept {
+        return std::chrono::nanoseconds(mCount ? mSum / std::int64_t(mCount) : 0);
+    }
+
+    std::chrono::nanoseconds LatencyHistogram::percentile(double q) const noexcept {
+        if (!mCount) return std::chrono::nanoseconds(0);
+        const auto rank = std::clamp<std::uint64_t>(std::uint64_t(std::ceil(q * double(mCount))), 1, mCount);
+        std::uint64_t seen = 0;
+        for (int i = 0; i < Buckets; ++i) {
+            if ((seen += mCounts[i]) >= rank) return std::chrono::nanoseconds(std::min(BucketTop(i), mMax));
+        }
+        return std::chrono::nanoseconds(mMax);
+    }
+
+    enum LatencyKind { Wait, Run, Wake, Kinds };
+
+    // the histograms a worker writes to. counts are only ever added to by workers and taken out by readers, so
+    // neither side has to lock
+    struct alignas(detail::CacheLine) LatencyRecorder::Shard {
+        struct Series {
+            std::atomic<std::uint64_t> counts[LatencyHistogram::Buckets]{};
+            std::atomic<std::int64_t> sum{0}, max{0};
+        } series[Kinds];
+
+        void Record(LatencyKind kind, std::chrono::nanoseconds value) noexcept {
+            auto& s = series[kind];
+            const auto v = std::max<std::int64_t>(value.count(), 0);
+            s.counts[LatencyHistogram::BucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+            s.sum.fetch_add(v, std::memory_order_relaxed);
+            for (auto max = s.max.load(std::memory_order_relaxed); max < v;) {
+                if (s.max.compare_exchange_weak(max, v, std::memory_order_relaxed)) break;
+            }
+        }
+
+        void Collect(LatencyKind kind, LatencyHistogram& into, bool reset) noexcept {
+            auto& s = series[kind];
+            const auto take = [reset](auto& value) noexcept {
+                return reset ? value.exchange(0, std::memory_order_relaxed) : value.load(std::memory_order_relaxed);
+            };
+            for (int i = 0; i < LatencyHistogram::Buckets; ++i) {
+                if (const auto n = take(s.counts[i]); n) into.Add(i, n);
+            }
+            into.AddTotals(take(s.sum), take(s.max));
+        }
+    };
+
+    // one shard per core is enough for the workers of any executor not to share one most of the time
+    LatencyRecorder::LatencyRecorder() :
+            mShards(int(std::clamp(std::thread::hardware_concurrency(), 1u, 16u))),
+            mShard(std::make_unique<Shard[]>(mShards)) {}
+
+    LatencyRecorder::~LatencyRecorder() { enable(false); }
+
+    void LatencyRecorder::enable(bool on) noexcept {
+        if (mOn.exchange(on) != on) detail::AddStamping(on ? 1 : -1);
+    }
+
+    LatencyRecorder::Shard& LatencyRecorder::Local() noexcept {
+        static std::atomic_uint next{0};
+        static thread_local const unsigned slot = next.fetch_add(1, std::memory_order_relaxed);
+        return mShard[slot % unsigned(mShards)];
+    }
+
+    LatencyReport LatencyRecorder::collect(bool reset) {
+        LatencyReport report{};
+        for (int i = 0; i < mShards; ++i) {
+            mShard[i].Collect(Wait, report.wait, reset);
+            mShard[i].Collect(Run, report.run, reset);
+            mShard[i].Collect(Wake, report.wake, reset);
+        }
+        return report;
+    }
+
+    void LatencyRecorder::record_wait(std::chrono::nanoseconds value) noexcept { Local().Record(Wait, value); }
+
+    void LatencyRecorder::record_run(std::chrono::nanoseconds value) noexcept { Local().Record(Run, value); }
+
+    void LatencyRecorder::record_wake(std::chrono::nanoseconds value) noexcept { Local().Record(Wake, value); }
+}
@@ -21,10 +21,16 @@
 */
 
 #include <cassert>
+#include "kls/thread/SpinLock.h"
 #include "kls/coroutine/Mutex.h"
 
 namespace kls::coroutine {
-    Mutex::Mutex() noexcept: m_state(not_locked), m_waiters(nullptr) {}
+    // bounds the nesting of in-place resumptions on one thread, as every inline handoff adds stack frames
+    static constexpr int max_inline_depth = 16;
+    static thread_local int g_inline_depth = 0;
+
+    Mutex::Mutex(MutexHandoff handoff, int spin) noexcept:
+            m_state(not_locked), m_waiters(nullptr), m_handoff(handoff), m_spin(spin) {}
 
     Mutex::~Mutex() {
         [[maybe_unused]] auto state = m_state.load(std::memory_order_relaxed);
@@ -33,26 +39,73 @@ namespace kls::coroutine {
     }
 
     bool Mutex::try_lock() noexcept {
-        // Try to atomically transition from nullptr (not-locked) -> this (locked-no-waiters).
-        auto oldState = not_locked;
-        return m_state.compare_exchange_strong(
-                oldState, locked_no_waiters, std::memory_order_acquire, std::memory_order_relaxed
-        );
+        const auto acquired = try_acquire();
+        if (acquired) m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+        return acquired;
     }
 
-    void Mutex::unlock() {
-        assert(m_state.load(std::memory_order_relaxed) != not_locked);
+    bool Mutex::try_acquire() noexcept {
+        // Try to atomically clear the not_locked bit. The rest of the state is left untouched,
+        // as in barging mode the mutex can be released while waiters are still queued.
+        auto oldState = m_state.load(std::memory_order_relaxed);
+        while (oldState & not_locked) {
+            if (m_state.compare_exchange_weak(
+                    oldState, oldState & ~not_locked, std::memory_order_acquire, std::memory_order_relaxed
+            ))
+                return true;
+        }
+        return false;
+    }
+
+    bool Mutex::spin_acquire() noexcept {
+        if (m_spin <= 0) return false;
+        // announce the spinning so that a barging unlock can release the mutex to us. the announcement and its
+        // withdrawal are seq_cst, as is the final attempt in MutexAcquire::await_suspend, so that release() sees
+        // either the spinner still counted or its waiter queued
+        m_spinning.fetch_add(1);
+        thread::SpinWait spinner{};
+        for (auto i = 0; i < m_spin; ++i) {
+            spinner.once();
+            if (try_acquire()) return (m_spinning.fetch_sub(1), true);
+        }
+        m_spinning.fetch_sub(1);
+        return false;
+    }
+
+    MutexAcquire *Mutex::release() noexcept {
+        // the lock stays held while the entries of cancelled waits are dequeued and skipped
+        for (;;) {
+            if (const auto waiter = dequeue(); !waiter || waiter->claim()) return waiter;
+        }
+    }
+
+    MutexAcquire *Mutex::dequeue() noexcept {
+        assert((m_state.load(std::memory_order_relaxed) & not_locked) == 0);
         MutexAcquire *waitersHead = m_waiters;
         if (waitersHead == nullptr) {
             auto oldState = locked_no_waiters;
             const bool releasedLock = m_state.compare_exchange_strong(
                     oldState, not_locked, std::memory_order_release, std::memory_order_relaxed
             );
-            if (releasedLock) return;
+            if (releasedLock) return nullptr;
+        }
+
+        if (m_handoff == MutexHandoff::Barging) {
+            // Release the lock with the waiters still queued if someone is spinning on it.
+            // Every spinner makes a final acquisition attempt before it suspends, so the lock
+            // will always be picked up by someone who will then serve the queued waiters.
+            // The state is read before the spinner count, both seq_cst, pairing with the spinner that withdraws
+            // and then queues itself: a state that already holds its waiter implies that the count has dropped.
+            auto oldState = m_state.load();
+            while (m_spinning.load() > 0) {
+                if (m_state.compare_exchange_weak(oldState, oldState | not_locked)) return nullptr;
+            }
+        }
 
+        if (waitersHead == nullptr) {
             // At least one new waiter.
             // Acquire the list of new waiter operations atomically.
-            oldState = m_state.exchange(locked_no_waiters, std::memory_order_acquire);
+            auto oldState = m_state.exchange(locked_no_waiters, std::memory_order_acquire);
 
             assert(oldState != locked_no_waiters && oldState != not_locked);
 
@@ -70,33 +123,104 @@ namespace kls::coroutine {
         assert(waitersHead != nullptr);
 
         m_waiters = waitersHead->m_next;
+        return waitersHead;
+    }
 
+    void Mutex::unlock() {
         // Resume the waiter.
         // This will pass the ownership of the lock on to that operation/coroutine.
-        waitersHead->resume();
+        if (const auto waiter = release(); waiter) waiter->resume();
+    }
+
+    MutexStatistics Mutex::statistics() const noexcept {
+        return {
+                m_acquisitions.load(std::memory_order_relaxed),
+                m_contended.load(std::memory_order_relaxed),
+                std::chrono::nanoseconds(m_wait_ns.load(std::memory_order_relaxed))
+        };
+    }
+
+    void MutexAcquire::resume() {
+        if (m_mutex.m_handoff == MutexHandoff::Inline && m_exec == this_executor() && g_inline_depth < max_inline_depth) {
+            ++g_inline_depth;
+            m_handle.resume();
+            --g_inline_depth;
+        }
+        else if (m_exec) m_exec->enqueue(m_handle); else m_handle.resume();
+    }
+
+    // a cancellable acquisition is only handed the lock if its waiter has not given up, otherwise its entry
+    // has been left behind for us to free
+    bool MutexAcquire::claim() noexcept {
+        if (!m_ticket) return true;
+        const auto ticket = static_cast<detail::MutexTicket *>(this);
+        if (ticket->grant()) return true;
+        return delete ticket, false;
+    }
+
+    // an acquisition whose first attempt fails counts as contended, and its wait includes any spinning
+    bool MutexAcquire::await_ready() noexcept {
+        if (m_mutex.try_acquire()) return true;
+        m_since = std::chrono::steady_clock::now();
+        return m_mutex.spin_acquire();
     }
 
     bool MutexAcquire::await_suspend(std::coroutine_handle<> h) noexcept {
         m_handle = h;
+        if (m_since == std::chrono::steady_clock::time_point{}) m_since = std::chrono::steady_clock::now();
         std::uintptr_t oldState = m_mutex.m_state.load(std::memory_order_acquire);
         while (true) {
-            if (oldState == Mutex::not_locked) {
+            if (oldState & Mutex::not_locked) {
                 if (m_mutex.m_state.compare_exchange_weak(
-                        oldState, Mutex::locked_no_waiters,
+                        oldState, oldState & ~Mutex::not_locked,
                         std::memory_order_acquire, std::memory_order_relaxed
                 ))
                     return false; // Acquired lock, don't suspend.
             } else {
-                // Try to push this operation onto the head of the waiter stack.
+                // Try to push this operation onto the head of the waiter stack. seq_cst pairs with the
+                // barging release(), see Mutex::spin_acquire.
                 m_next = reinterpret_cast<MutexAcquire *>(oldState);
-                if (m_mutex.m_state.compare_exchange_weak(
-                        oldState, reinterpret_cast<std::uintptr_t>(this),
-                        std::memory_order_release, std::memory_order_relaxed
-                ))
+                if (m_mutex.m_state.compare_exchange_weak(oldState, reinterpret_cast<std::uintptr_t>(this)))
                     return true; // Queued operation to waiters list, suspend now.
             }
         }
     }
 
+    Mutex &MutexAcquire::await_resume() noexcept {
+        m_mutex.m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (m_since != std::chrono::steady_clock::time_point{}) {
+            const auto wait = std::chrono::steady_clock::now() - m_since;
+            m_mutex.m_contended.fetch_add(1, std::memory_order_relaxed);
+            m_mutex.m_wait_ns.fetch_add(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count(), std::memory_order_relaxed
+            );
+        }
+        return m_mutex;
+    }
+
+    std::coroutine_handle<> MutexUnlock::await_suspend(std::coroutine_handle<> h) noexcept {
+        const auto waiter = m_mutex.release();
+        if (!waiter) return h;
+        // transfer to the waiter directly and queue ourselves behind, if both of us live on the same executor
+        if (const auto exec = this_executor(); exec && waiter->m_exec == exec) {
+            const auto next = waiter->m_handle;
+            return exec->enqueue(h), next;
+        }
+        return waiter->resume(), h;
+    }
+
+    bool detail::MutexWaitCore::trap(std::coroutine_handle<> h) {
+        if (m_acquire.await_ready()) return false;
+        m_acquire.m_handle = h;
+        m_ticket = new MutexTicket(m_acquire);
+        if (m_ticket->await_suspend(h)) return true;
+        return delete std::exchange(m_ticket, nullptr), false; // acquired on the way
+    }
+
+    Mutex &detail::MutexWaitCore::get() noexcept {
+        delete std::exchange(m_ticket, nullptr);
+        return m_acquire.await_resume();
+    }
+
     MutexLock::~MutexLock() { if (m_mutex != nullptr) m_mutex->unlock(); }
 }
\ No newline at end of file
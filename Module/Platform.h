@@ -22,41 +22,26 @@
 
 #pragma once
 
-#include <mutex>
-#include "kls/temp/Queue.h"
-#include "kls/thread/SpinLock.h"
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace kls::coroutine::detail {
-    template<class Task, bool Fast = false>
-    class FifoQueue {
-    public:
-        void Add(const Task& t) {
-            std::lock_guard lk{ mSpin };
-            mTasks.Push(t);
-        }
-
-        [[nodiscard]] Task Get() noexcept {
-            if (auto exec = LockedPop(); exec) return exec;
-            if constexpr (!Fast) {
-                thread::SpinWait spinner{};
-                for (auto i = 0u; i < thread::SpinWait::SpinCountForSpinBeforeWait; ++i) {
-                    spinner.once();
-                    if (auto exec = LockedPop(); exec) return exec;
-                }
-            }
-            return {};
-        }
-
-        [[nodiscard]] bool SnapshotNotEmpty() const noexcept { return !mTasks.Empty(); }
-
-        void Finalize() noexcept {}
-    private:
-        thread::SpinLock mSpin{};
-        temp::Queue<Task> mTasks{};
-
-        auto LockedPop() {
-            std::lock_guard lk{ mSpin };
-            return mTasks.Pop();
-        }
-    };
+    // pins the calling thread to a core. negative values and unsupported platforms leave the affinity alone
+    inline void PinCurrentThread(int cpu) noexcept {
+        if (cpu < 0) return;
+#if defined(_WIN32)
+        SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    }
 }
@@ -0,0 +1,194 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <coroutine>
+#include "kls/coroutine/Profile.h"
+#include "kls/coroutine/Latency.h"
+#include "Executor.hpp"
+#include "kls/thread/SpinLock.h"
+
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+namespace kls::coroutine::detail {
+    static thread_local const TaskTag* gTag{ nullptr };
+    static std::atomic_bool gProfiling{ false };
+    // profiling and every enabled latency recorder, enqueues are stamped while there is any
+    static std::atomic_int gStamping{ 0 };
+    // every live tag, most recent first. tags come and go rarely and reports are rare, so a lock will do
+    static thread::SpinLock gTagLock{};
+    static const TaskTag* gTags{ nullptr };
+
+    struct TagAccess {
+        static void Enlist(TaskTag* tag) noexcept {
+            std::lock_guard lk{ gTagLock };
+            tag->mNext = std::exchange(gTags, tag);
+        }
+
+        static void Delist(TaskTag* tag) noexcept {
+            std::lock_guard lk{ gTagLock };
+            for (auto p = &gTags; *p; p = &(*p)->mNext) {
+                if (*p == tag) return void(*p = tag->mNext);
+            }
+        }
+
+        static const TaskTag* Next(const TaskTag* tag) noexcept { return tag->mNext; }
+
+        static void Account(const TaskTag* tag, std::int64_t cpu, std::int64_t wait) noexcept {
+            tag->mResumes.fetch_add(1, std::memory_order_relaxed);
+            tag->mCpu.fetch_add(cpu, std::memory_order_relaxed);
+            if (wait > 0) tag->mWait.fetch_add(wait, std::memory_order_relaxed);
+        }
+
+        static TaskProfile Report(const TaskTag* tag, const TaskTag* as) noexcept {
+            return {
+                as, tag->mResumes.load(std::memory_order_relaxed),
+                std::chrono::nanoseconds(tag->mCpu.load(std::memory_order_relaxed)),
+                std::chrono::nanoseconds(tag->mWait.load(std::memory_order_relaxed))
+            };
+        }
+
+        static void Reset(const TaskTag* tag) noexcept {
+            tag->mResumes.store(0, std::memory_order_relaxed);
+            tag->mCpu.store(0, std::memory_order_relaxed);
+            tag->mWait.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    // stands for untagged work. having no name it is never enlisted, so it only shows up as the null tag
+    static TaskTag& Untagged() noexcept {
+        static TaskTag untagged{ nullptr, std::source_location{} };
+        return untagged;
+    }
+
+    static std::int64_t Ticks() noexcept {
+        const auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    }
+
+    // cpu time of the calling thread. windows has no precise counter in time units for it, so the wall time of
+    // the run stands in, which only differs when the thread gets preempted
+    static std::int64_t ThreadCpu() noexcept {
+#if defined(_WIN32)
+        return Ticks();
+#else
+        timespec ts{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return std::int64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+#endif
+    }
+
+    std::int64_t QueueStamp() noexcept { return gStamping.load(std::memory_order_relaxed) ? Ticks() : 0; }
+
+    void AddStamping(int delta) noexcept { gStamping.fetch_add(delta); }
+
+    // nullptr unless the executor running this thread records its latencies
+    static LatencyRecorder* Recording() noexcept {
+        const auto exec = this_executor();
+        const auto recorder = exec ? exec->latency_recorder() : nullptr;
+        return (recorder && recorder->enabled()) ? recorder : nullptr;
+    }
+
+    // a coroutine frame is never at an odd address, neither is a node
+    static constexpr std::uintptr_t TracedBit = 1;
+
+    void* TracedTask(TaskNode& node) noexcept {
+        if (!node.tag && !node.queued) return node.handle;
+        return reinterpret_cast<void*>(reinterpret_cast<std::uintptr_t>(&node) | TracedBit);
+    }
+
+    void ResumeTask(void* task, TaskTrace trace) noexcept {
+        if (const auto bits = reinterpret_cast<std::uintptr_t>(task); bits & TracedBit) {
+            // the node lives in the suspended frame, so it is read before the resume
+            const auto node = reinterpret_cast<const TaskNode*>(bits & ~TracedBit);
+            task = node->handle, trace = { node->tag, node->queued, node->woken };
+        }
+        const auto handle = std::coroutine_handle<>::from_address(task);
+        // a task run by a helping thread returns into the task that was blocked, so its tag is put back afterwards
+        const auto last = std::exchange(gTag, trace.tag);
+        if (!gStamping.load(std::memory_order_relaxed)) {
+            handle.resume();
+        }
+        else {
+            const auto profile = gProfiling.load(std::memory_order_relaxed);
+            const auto start = Ticks();
+            const auto wait = trace.queued ? start - trace.queued : 0;
+            const auto from = profile ? ThreadCpu() : 0;
+            handle.resume();
+            if (profile) TagAccess::Account(trace.tag ? trace.tag : &Untagged(), ThreadCpu() - from, wait);
+            // looked up only now, as nothing held from before the run is known to be valid once the task ran
+            if (const auto recorder = Recording(); recorder) {
+                recorder->record_run(std::chrono::nanoseconds(Ticks() - start));
+                if (trace.queued) recorder->record_wait(std::chrono::nanoseconds(wait));
+                if (trace.queued && trace.woken) recorder->record_wake(std::chrono::nanoseconds(wait));
+            }
+        }
+        gTag = last;
+    }
+}
+
+namespace kls::coroutine {
+    const TaskTag* this_tag() noexcept { return detail::gTag; }
+
+    TagScope::TagScope(const TaskTag& tag) noexcept : mLast(std::exchange(detail::gTag, &tag)) {}
+
+    TagScope::~TagScope() noexcept { detail::gTag = mLast; }
+
+    TaskTag::TaskTag(const char* name, std::source_location where) noexcept : mName(name), mWhere(where) {
+        if (name) detail::TagAccess::Enlist(this);
+    }
+
+    TaskTag::~TaskTag() noexcept { if (mName) detail::TagAccess::Delist(this); }
+
+    void set_profiling(bool enabled) noexcept {
+        if (detail::gProfiling.exchange(enabled) != enabled) detail::AddStamping(enabled ? 1 : -1);
+    }
+
+    bool profiling() noexcept { return detail::gProfiling.load(); }
+
+    std::vector<TaskProfile> profile_report() {
+        std::vector<TaskProfile> result{};
+        const auto add = [&](const TaskTag* tag, const TaskTag* as) {
+            if (auto line = detail::TagAccess::Report(tag, as); line.resumes) result.push_back(line);
+        };
+        {
+            std::lock_guard lk{ detail::gTagLock };
+            for (auto tag = detail::gTags; tag; tag = detail::TagAccess::Next(tag)) add(tag, tag);
+        }
+        add(&detail::Untagged(), nullptr);
+        std::sort(result.begin(), result.end(), [](auto& l, auto& r) noexcept { return l.cpu > r.cpu; });
+        return result;
+    }
+
+    void reset_profile() noexcept {
+        {
+            std::lock_guard lk{ detail::gTagLock };
+            for (auto tag = detail::gTags; tag; tag = detail::TagAccess::Next(tag)) detail::TagAccess::Reset(tag);
+        }
+        detail::TagAccess::Reset(&detail::Untagged());
+    }
+}
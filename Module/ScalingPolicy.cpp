@@ -0,0 +1,61 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <algorithm>
+#include "kls/coroutine/Scaling.h"
+
+namespace kls::coroutine {
+    AdaptiveScalingPolicy::AdaptiveScalingPolicy(Options options) noexcept:
+            IScalingPolicy(
+                    static_cast<FnDecide>(&AdaptiveScalingPolicy::DecideImpl),
+                    static_cast<FnRecord>(&AdaptiveScalingPolicy::RecordImpl)
+            ),
+            mOptions(std::move(options)) {}
+
+    ScalingDecision AdaptiveScalingPolicy::DecideImpl(const ScalingSample &sample) noexcept {
+        // the gap between the grow and the shrink marks keeps a load near either of them from flapping
+        if (sample.reason == ScalingSample::Reason::Idle) {
+            const auto quiet = sample.queue_wait < mOptions.shrink_wait &&
+                               sample.utilization < mOptions.shrink_utilization;
+            return quiet ? ScalingDecision::Retire : ScalingDecision::Hold;
+        }
+        const auto pressed = sample.queue_wait > mOptions.grow_wait ||
+                             (!sample.parked && sample.utilization > mOptions.grow_utilization);
+        if (!pressed || sample.now - mLastSpawn < mOptions.spawn_interval) return ScalingDecision::Hold;
+        return ScalingDecision::Spawn;
+    }
+
+    void AdaptiveScalingPolicy::RecordImpl(const ScalingEvent &event) noexcept {
+        if (event.decision == ScalingDecision::Spawn) {
+            mLastSpawn = event.sample.now;
+            mSpawned.fetch_add(1, std::memory_order_relaxed);
+        } else mRetired.fetch_add(1, std::memory_order_relaxed);
+        if (mOptions.sink) mOptions.sink(event);
+    }
+
+    void ScalingControl::set_limits(ScalingLimits limits) noexcept {
+        const auto min = std::max(limits.min, 0);
+        mMin.store(min, std::memory_order_relaxed);
+        mMax.store(std::max({limits.max, min, 1}), std::memory_order_relaxed);
+        mLinger.store(std::max<std::chrono::milliseconds::rep>(limits.linger.count(), 0), std::memory_order_relaxed);
+    }
+}
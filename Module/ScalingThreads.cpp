@@ -20,18 +20,50 @@
 * SOFTWARE.
 */
 
-#include "FifoQueue.h"
 #include "BagQueue.h"
-#include "ScalingExecutor.h"
+#include "DeadlineQueue.h"
+#include "kls/coroutine/PolicyExecutor.h"
+#include "kls/coroutine/detail/FifoQueue.h"
 
 namespace kls::coroutine {
+    namespace {
+        template<template<class> class Queue, class ...U>
+        std::shared_ptr<ScalingControl> Create(ScalingLimits limits, std::shared_ptr<IScalingPolicy> policy, U &&... queue) {
+            return std::make_shared<PolicyExecutor<Queue>>(limits, std::move(policy), std::forward<U>(queue)...);
+        }
+
+        // shares ownership with the control
+        std::shared_ptr<IExecutor> Plain(std::shared_ptr<ScalingControl> control) {
+            const auto executor = control->executor();
+            return {std::move(control), executor};
+        }
+
+        ScalingLimits Limits(int min, int max, int linger) { return {min, max, std::chrono::milliseconds(linger)}; }
+    }
+
     std::shared_ptr<IExecutor> CreateScalingFIFOExecutor(int min, int max, int linger) {
-        using namespace detail;
-        return std::make_shared<ScalingExecutor<FifoQueue>>(min, max, linger);
+        return Plain(CreateScalingFIFOExecutor(Limits(min, max, linger)));
     }
 
     std::shared_ptr<IExecutor> CreateScalingBagExecutor(int min, int max, int linger) {
-        using namespace detail;
-        return std::make_shared<ScalingExecutor<BagQueue>>(min, max, linger);
+        return Plain(CreateScalingBagExecutor(Limits(min, max, linger)));
+    }
+
+    std::shared_ptr<IExecutor> CreateScalingDeadlineExecutor(int min, int max, int linger, bool demote_expired) {
+        return Plain(CreateScalingDeadlineExecutor(Limits(min, max, linger), demote_expired));
+    }
+
+    std::shared_ptr<ScalingControl> CreateScalingFIFOExecutor(ScalingLimits limits, std::shared_ptr<IScalingPolicy> policy) {
+        return Create<detail::FifoQueue>(limits, std::move(policy));
+    }
+
+    std::shared_ptr<ScalingControl> CreateScalingBagExecutor(ScalingLimits limits, std::shared_ptr<IScalingPolicy> policy) {
+        return Create<detail::BagQueue>(limits, std::move(policy));
+    }
+
+    std::shared_ptr<ScalingControl> CreateScalingDeadlineExecutor(
+            ScalingLimits limits, bool demote_expired, std::shared_ptr<IScalingPolicy> policy
+    ) {
+        return Create<detail::DeadlineQueue>(limits, std::move(policy), demote_expired);
     }
 }
@@ -0,0 +1,208 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <deque>
+#include <thread>
+#include <algorithm>
+#include "SpscRing.h"
+#include "Platform.h"
+#include "kls/coroutine/detail/CacheLine.h"
+#include "kls/coroutine/detail/FifoQueue.h"
+#include "Executor.hpp"
+#include "kls/thread/SpinLock.h"
+#include "kls/thread/Semaphore.h"
+#include "kls/coroutine/Operation.h"
+
+namespace kls::coroutine::detail {
+    static thread_local const void* gShardGroup{ nullptr };
+    static thread_local int gShardIndex{ -1 };
+}
+
+namespace kls::coroutine {
+    int this_shard() noexcept { return detail::gShardIndex; }
+
+    class ShardedExecutor::Shard final : public IExecutor {
+        // one per sending shard. once the ring fills up the sender spills, and keeps spilling until the
+        // receiver took the spill over, so nothing it sends later can overtake what it spilled
+        struct Inbound {
+            detail::SpscRing<void*, 256> ring{};
+            std::atomic_bool spilled{ false };
+            thread::SpinLock lock{};
+            std::deque<void*> spill{};
+        };
+        // what arrived from outside the group keeps the trace of its node, the rings carry it in the handle
+        struct Local {
+            void* task;
+            detail::TaskTrace trace{};
+        };
+    public:
+        Shard(const ShardedExecutor* group, int index, int count) :
+            IExecutor(static_cast<FnEnqueue>(&Shard::EnqueueRawImpl), static_cast<FnEnqueueNode>(&Shard::EnqueueNodeImpl)),
+            mGroup(group), mIndex(index), mCount(count), mInbound(new Inbound[count]) {}
+
+        void Start(int cpu) { mThread = std::thread([this, cpu]() noexcept { detail::PinCurrentThread(cpu), Run(); }); }
+
+        ValueAsync<void> Shutdown() {
+            co_await SwitchTo{ this };
+            mRunning = false;
+        }
+
+        void Join() { mThread.join(); }
+
+        // runs what other shards sent after this one stopped, on the thread tearing the group down once every
+        // shard has been joined. returns whether there was anything
+        bool DrainTail() noexcept {
+            const auto previous = this_executor();
+            detail::SetCurrentExecutor(this);
+            bool ran = false;
+            while (Collect() || !mLocal.empty()) RunLocal(), ran = true;
+            detail::SetCurrentExecutor(previous);
+            return ran;
+        }
+    private:
+        void EnqueueRawImpl(void* handle) noexcept {
+            if (detail::gShardGroup == mGroup) {
+                // the shard's own thread is the only one ever touching the local queue
+                if (detail::gShardIndex == mIndex) return mLocal.push_back({ handle });
+                auto& in = mInbound[detail::gShardIndex];
+                if (!in.spilled.load(std::memory_order_acquire) && in.ring.Push(handle)) return Wake();
+                {
+                    std::lock_guard lk{ in.lock };
+                    in.spilled.store(true, std::memory_order_relaxed);
+                    in.spill.push_back(handle);
+                }
+                return Wake();
+            }
+            mExternal.Add(handle);
+            Wake();
+        }
+
+        // shard to shard traffic goes through the rings, which do not allocate anyway. they take the node as a
+        // traced handle, so the task keeps its tag
+        void EnqueueNodeImpl(TaskNode* node) noexcept {
+            if (detail::gShardGroup == mGroup) return EnqueueRawImpl(detail::TracedTask(*node));
+            mExternal.Link(node);
+            Wake();
+        }
+
+        void Wake() noexcept {
+            // pairs with the fence in Park: either the shard sees the new item, or this sees it going to sleep
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (mSleeping.load(std::memory_order_relaxed) && mSleeping.exchange(false)) mSignal.signal();
+        }
+
+        void Run() noexcept {
+            detail::gShardGroup = mGroup;
+            detail::gShardIndex = mIndex;
+            detail::SetCurrentExecutor(this);
+            while (mRunning) {
+                RunLocal();
+                if (!Collect() && mLocal.empty() && mRunning) Park();
+            }
+        }
+
+        // runs what is queued right now. anything it queues locally waits for the next round so the inbound
+        // rings are not starved by a coroutine that keeps redispatching itself
+        void RunLocal() noexcept {
+            for (auto n = mLocal.size(); n; --n) {
+                const auto [task, trace] = mLocal.front();
+                mLocal.pop_front();
+                detail::ResumeTask(task, trace);
+            }
+        }
+
+        // moves all inbound work to the local queue, one batch per ring
+        bool Collect() noexcept {
+            std::size_t got = 0;
+            const auto local = [this](void* h) { mLocal.push_back({ h }); };
+            for (int i = 0; i < mCount; ++i) {
+                auto& in = mInbound[i];
+                got += in.ring.Drain(local);
+                if (!in.spilled.load(std::memory_order_acquire)) continue;
+                // the sender does not touch the ring while spilled, so what is in there now predates the spill
+                std::lock_guard lk{ in.lock };
+                got += in.ring.Drain(local) + in.spill.size();
+                for (const auto h : in.spill) mLocal.push_back({ h });
+                in.spill.clear();
+                in.spilled.store(false, std::memory_order_release);
+            }
+            for (detail::TaskTrace trace{}; const auto h = mExternal.Get(trace); ++got) mLocal.push_back({ h, trace });
+            return got;
+        }
+
+        [[nodiscard]] bool HasInbound() const noexcept {
+            for (int i = 0; i < mCount; ++i) {
+                if (mInbound[i].ring.SnapshotNotEmpty() || mInbound[i].spilled.load(std::memory_order_relaxed)) return true;
+            }
+            return mExternal.SnapshotNotEmpty();
+        }
+
+        void Park() noexcept {
+            mSleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (HasInbound()) {
+                // raced with a sender. if it already took the flag back, its signal is still to be consumed
+                if (!mSleeping.exchange(false)) mSignal.wait();
+                return;
+            }
+            mSignal.wait();
+        }
+
+        const void* const mGroup;
+        const int mIndex, mCount;
+        std::unique_ptr<Inbound[]> mInbound; // indexed by the sending shard
+        std::deque<Local> mLocal{};
+        detail::FifoQueue<void*, true> mExternal{};
+        alignas(detail::CacheLine) std::atomic_bool mSleeping{ false }; // the only field senders write
+        bool mRunning{ true };
+        thread::Semaphore mSignal{};
+        std::thread mThread{};
+    };
+
+    ShardedExecutor::ShardedExecutor(int n, bool pin) {
+        const auto cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        mShards.reserve(n);
+        for (int i = 0; i < n; ++i) mShards.push_back(new Shard(this, i, n));
+        // every shard has to exist before any of them can send to another
+        for (int i = 0; i < n; ++i) mShards[i]->Start(pin ? i % cores : -1);
+    }
+
+    ShardedExecutor::~ShardedExecutor() {
+        for (const auto shard : mShards) shard->Shutdown();
+        // shards may keep sending to each other until all of them stopped, so none is freed before all joined
+        for (const auto shard : mShards) shard->Join();
+        // what landed on a shard after it stopped is run here instead of dropped. it may send more, so go again
+        for (bool ran = true; ran;) {
+            ran = false;
+            for (const auto shard : mShards) ran |= shard->DrainTail();
+        }
+        for (const auto shard : mShards) delete shard;
+    }
+
+    int ShardedExecutor::size() const noexcept { return static_cast<int>(mShards.size()); }
+
+    IExecutor* ShardedExecutor::shard(int i) const noexcept { return mShards[i]; }
+
+    std::shared_ptr<ShardedExecutor> CreateShardedExecutor(int n, bool pin) {
+        return std::make_shared<ShardedExecutor>(n, pin);
+    }
+}
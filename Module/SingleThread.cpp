@@ -21,39 +21,51 @@
 */
 
 #include <mutex>
-#include "FifoQueue.h"
+#include <chrono>
+#include "Platform.h"
+#include "kls/coroutine/detail/Spin.h"
+#include "kls/coroutine/detail/FifoQueue.h"
 #include "Executor.hpp"
 #include "kls/thread/Semaphore.h"
 #include "kls/coroutine/Operation.h"
 
 namespace kls::coroutine {
-    std::shared_ptr<IExecutor> CreateSingleThreadExecutor() {
+    std::shared_ptr<IExecutor> CreateSingleThreadExecutor(std::chrono::nanoseconds spin, int cpu) {
         class Executor final : public IExecutor {
         public:
-            Executor() :
-                IExecutor(static_cast<FnEnqueue>(&Executor::EnqueueRawImpl)),
-                mRunning(true), mThread([this]()noexcept { ThreadRun(); })
+            Executor(std::chrono::nanoseconds spin, int cpu) :
+                IExecutor(
+                    static_cast<FnEnqueue>(&Executor::EnqueueRawImpl), static_cast<FnEnqueueNode>(&Executor::EnqueueNodeImpl)
+                ),
+                mRunning(true), mSpin(spin), mThread([this, cpu]()noexcept { detail::PinCurrentThread(cpu), ThreadRun(); })
             {}
             
             ~Executor() {
-                [this]() -> ValueAsync<void> {
-                    co_await SwitchTo{ this };
-                    mRunning = false;
-                }();
+                Shutdown();
                 mThread.join();
             }
 
         private:
+            ValueAsync<void> Shutdown() {
+                co_await SwitchTo{ this };
+                mRunning = false;
+            }
+
             void ThreadRun() noexcept {
                 while (mRunning) {
                     detail::SetCurrentExecutor(this);
                     DoWorks();
-                    if (mRunning) Rest();
+                    if (mRunning && !Poll()) Rest();
                 }
             }
 
             void EnqueueRawImpl(void* address) noexcept {
                 mQueue.Add(address);
+                WakeOne(); // costs nothing but a load while the loop is polling, as it has not parked
+            }
+
+            void EnqueueNodeImpl(TaskNode* node) noexcept {
+                mQueue.Link(node);
                 WakeOne();
             }
 
@@ -66,6 +78,9 @@ namespace kls::coroutine {
                 }
             }
 
+            // busy-polls the queue for up to mSpin. false if it stayed empty
+            bool Poll() noexcept { return detail::SpinFor(mSpin, [this]() noexcept { return mQueue.SnapshotNotEmpty(); }); }
+
             void Rest() noexcept {
                 mPark.fetch_add(1); // enter protected region
                 if (mQueue.SnapshotNotEmpty()) {
@@ -79,15 +94,22 @@ namespace kls::coroutine {
             }
 
             void DoWorks() noexcept {
-                for (;;) if (auto exec = mQueue.Get(); exec) std::coroutine_handle<>::from_address(exec).resume(); else return;
+                for (detail::TaskTrace trace{};;) {
+                    if (auto exec = mQueue.Get(trace); exec) detail::ResumeTask(exec, trace); else return;
+                }
             }
 
             std::atomic_bool mRunning;
+            const std::chrono::nanoseconds mSpin;
             detail::FifoQueue<void*> mQueue;
             std::atomic_int mPark{ 0 };
             thread::Semaphore mSignal{};
             std::thread mThread;
         };
-        return std::make_shared<Executor>();
+        return std::make_shared<Executor>(spin, cpu);
+    }
+
+    std::shared_ptr<IExecutor> CreateSingleThreadExecutor() {
+        return CreateSingleThreadExecutor(std::chrono::nanoseconds::zero(), -1);
     }
 }
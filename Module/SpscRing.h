@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include "kls/coroutine/detail/CacheLine.h"
+
+namespace kls::coroutine::detail {
+    // bounded lock-free ring for exactly one producer thread and one consumer thread
+    template<class Task, std::size_t Size>
+    class SpscRing {
+        static_assert(Size && !(Size & (Size - 1)), "ring size must be a power of two");
+    public:
+        // producer side. false if the ring is full
+        bool Push(const Task &t) noexcept {
+            const auto tail = mTail.load(std::memory_order_relaxed);
+            if (tail - mHeadCache == Size) {
+                // only go for the consumer's cache line when the cached view says full
+                mHeadCache = mHead.load(std::memory_order_acquire);
+                if (tail - mHeadCache == Size) return false;
+            }
+            mSlots[tail & (Size - 1)] = t;
+            mTail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side. hands everything published so far to fn, and releases the slots at once
+        template<class Fn>
+        std::size_t Drain(Fn &&fn) {
+            const auto head = mHead.load(std::memory_order_relaxed);
+            const auto tail = mTail.load(std::memory_order_acquire);
+            for (auto i = head; i != tail; ++i) fn(mSlots[i & (Size - 1)]);
+            mHead.store(tail, std::memory_order_release);
+            return tail - head;
+        }
+
+        [[nodiscard]] bool SnapshotNotEmpty() const noexcept {
+            return mHead.load(std::memory_order_relaxed) != mTail.load(std::memory_order_acquire);
+        }
+    private:
+        alignas(CacheLine) std::atomic_size_t mTail{0};
+        std::size_t mHeadCache{0};
+        alignas(CacheLine) std::atomic_size_t mHead{0};
+        alignas(CacheLine) Task mSlots[Size]{};
+    };
+}
@@ -20,8 +20,9 @@
 * SOFTWARE.
 */
 
-#include <queue>
+#include <set>
 #include <mutex>
+#include <functional>
 #include "kls/thread/SpinLock.h"
 #include "kls/thread/Semaphore.h"
 #include "kls/coroutine/Timed.h"
@@ -34,22 +35,25 @@ namespace kls::coroutine::detail {
         Time time;
         SingleExecutorTrigger *await;
 
-        auto operator<=>(const Unit &r) const noexcept { return time <=> r.time; }
+        // units due at the same time are told apart by their trigger, so that a single one can be removed
+        bool operator<(const Unit &r) const noexcept {
+            return time < r.time || (time == r.time && std::less<>{}(await, r.await));
+        }
     };
 
     class Timed {
     public:
         void add(Unit unit) {
             std::lock_guard lk{m_lock};
-            if (m_queue.empty()) {
-                m_queue.push(unit);
-                m_signal.signal();
-            }
-            else {
-                Unit top = m_queue.top();
-                m_queue.push(unit);
-                if (top > unit) m_signal.signal();
-            }
+            const bool earliest = m_queue.empty() || unit < *m_queue.begin();
+            m_queue.insert(unit);
+            if (earliest) m_signal.signal();
+        }
+
+        // units are pulled with the lock held, so a unit that could not be removed has already been pulled
+        bool remove(Unit unit) noexcept {
+            std::lock_guard lk{m_lock};
+            return m_queue.erase(unit) != 0;
         }
 
         static Timed &get() {
@@ -59,10 +63,11 @@ namespace kls::coroutine::detail {
 
     private:
         std::atomic_bool m_stop{false};
-        std::thread m_thread{[this] { run(); }};
         thread::SpinLock m_lock;
         thread::Semaphore m_signal;
-        std::priority_queue<Unit, std::vector<Unit>, std::greater<>> m_queue;
+        std::set<Unit> m_queue;
+        // declared last, the thread touches all of the above as soon as it starts
+        std::thread m_thread{[this] { run(); }};
 
         ~Timed() {
             m_stop.store(true);
@@ -80,8 +85,8 @@ namespace kls::coroutine::detail {
                 }
                 else {
                     const auto now = Clock::now();
-                    if (const auto top = m_queue.top(); now >= top.time) {
-                        m_queue.pop();
+                    if (const auto top = *m_queue.begin(); now >= top.time) {
+                        m_queue.erase(m_queue.begin());
                         top.await->pull();
                     } else {
                         lk.unlock();
@@ -97,4 +102,16 @@ namespace kls::coroutine {
     DelayAwait delay_until(std::chrono::steady_clock::time_point tp) {
         return DelayAwait{[tp](SingleExecutorTrigger *ths) { detail::Timed::get().add({tp, ths}); }};
     }
+
+    CancellableDelayAwait delay_until(std::chrono::steady_clock::time_point tp, CancellationToken token) {
+        return CancellableDelayAwait(std::move(token), tp);
+    }
+
+    bool detail::DelayCore::trap(std::coroutine_handle<> h) {
+        ExecutorAwaitEntry::set_handle(h);
+        detail::Timed::get().add({m_time, this});
+        return SingleExecutorTrigger::trap(*this);
+    }
+
+    bool detail::DelayCore::cancel() noexcept { return detail::Timed::get().remove({m_time, this}); }
 }
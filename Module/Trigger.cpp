@@ -73,6 +73,11 @@ void SingleExecutorTrigger::pull() {
     if (const auto h = set_trap(m_captured); h) static_cast<ExecutorAwaitEntry *>(h)->resume_async();
 }
 
+bool SingleExecutorTrigger::cancel(ExecutorAwaitEntry &h) noexcept {
+    void *expect = &h;
+    return m_captured.compare_exchange_strong(expect, nullptr);
+}
+
 static bool fifo_trap(std::atomic_bool& flag, SpinLock& lock, auto& head, auto& tail, auto next) noexcept {
     if (flag) return false;
     std::lock_guard lk{lock};
@@ -123,3 +128,17 @@ void FifoExecutorTrigger::drop() noexcept {
 void FifoExecutorTrigger::pull() {
     fifo_handle_list(fifo_set_trigger(m_done, m_lock, m_head), [](auto h) noexcept { h->resume_async(); });
 }
+
+bool FifoExecutorTrigger::cancel(FifoExecutorAwaitEntry &next) noexcept {
+    std::lock_guard lk{m_lock};
+    // once the flag is set the chain belongs to the puller
+    if (m_done) return false;
+    FifoExecutorAwaitEntry *prev = nullptr;
+    for (auto it = m_head; it; prev = it, it = it->get_next()) {
+        if (it != &next) continue;
+        if (prev) prev->set_next(it->get_next()); else m_head = it->get_next();
+        if (m_tail == it) m_tail = prev;
+        return it->set_next(nullptr), true;
+    }
+    return false;
+}
@@ -30,6 +30,8 @@
 #include <vector>
 #include <optional>
 #include <cassert>
+#include <algorithm>
+#include "kls/coroutine/detail/CacheLine.h"
 
 /**
 @class: WorkStealingQueue
@@ -72,8 +74,8 @@ class WorkStealingQueue {
             return S[i & M].load(std::memory_order_relaxed);
         }
 
-        Array *resize(int64_t b, int64_t t) {
-            Array *ptr = new Array{2 * C};
+        Array *resize(int64_t b, int64_t t, int64_t c) {
+            Array *ptr = new Array{c};
             for (int64_t i = t; i != b; ++i) {
                 ptr->push(i, pop(i));
             }
@@ -82,10 +84,37 @@ class WorkStealingQueue {
 
     };
 
-    std::atomic<int64_t> _top;
-    std::atomic<int64_t> _bottom;
+    // _top is cas'ed by stealers and _bottom written by the owner on every operation, keep them apart
+    alignas(kls::coroutine::detail::CacheLine) std::atomic<int64_t> _top;
+    alignas(kls::coroutine::detail::CacheLine) std::atomic<int64_t> _bottom;
     std::atomic<Array *> _array;
+    // retired arrays waiting for a grace period to start, and those retired before the running one started
     std::vector<Array *> _garbage;
+    std::vector<Array *> _draining;
+    // 0 without a grace period running, otherwise the number of epoch flips it has done so far
+    int _grace{0};
+    int64_t _initial;
+    int64_t _idle{0};
+    // steals in flight, counted by the parity of the epoch they started in. a grace period flips the epoch
+    // and waits for the old parity to drain, twice, so thieves arriving all the time never hold it up
+    alignas(kls::coroutine::detail::CacheLine) std::atomic<int64_t> _stealers[2]{0, 0};
+    std::atomic<int64_t> _epoch{0};
+
+    // keeps the caller counted in _stealers for its lifetime
+    struct _Announce {
+        std::atomic<int64_t> &count;
+        explicit _Announce(WorkStealingQueue &q) noexcept:
+                count(q._stealers[q._epoch.load(std::memory_order_seq_cst) & 1]) {
+            count.fetch_add(1, std::memory_order_seq_cst);
+        }
+        ~_Announce() { count.fetch_sub(1, std::memory_order_release); }
+    };
+
+    void _retire(Array *old, Array *now);
+
+    void _reclaim() noexcept;
+
+    void _try_shrink(Array *a);
 
 public:
 
@@ -139,6 +168,17 @@ public:
     The return can be a @std_nullopt if this operation failed (not necessary empty).
     */
     std::optional<T> steal();
+
+    /**
+    @brief steals up to half of the items, but at most max, in one go
+    Any threads can call it. Every stolen item is handed to out, typically to push it
+    to the queue the thief owns. Items are still claimed one CAS at a time, as claiming a
+    range at once could race with the owner popping the last of them, but the thief only
+    needs to find this queue once.
+    @return the number of items handed to out
+    */
+    template<typename O>
+    size_t steal_batch(O &&out, size_t max);
 };
 
 // Constructor
@@ -149,6 +189,7 @@ WorkStealingQueue<T>::WorkStealingQueue(int64_t c) {
     _bottom.store(0, std::memory_order_relaxed);
     _array.store(new Array{c}, std::memory_order_relaxed);
     _garbage.reserve(32);
+    _initial = c;
 }
 
 // Destructor
@@ -157,6 +198,9 @@ WorkStealingQueue<T>::~WorkStealingQueue() {
     for (auto a: _garbage) {
         delete a;
     }
+    for (auto a: _draining) {
+        delete a;
+    }
     delete _array.load();
 }
 
@@ -184,12 +228,13 @@ void WorkStealingQueue<T>::push(O &&o) {
     int64_t t = _top.load(std::memory_order_acquire);
     Array *a = _array.load(std::memory_order_relaxed);
 
+    if (_grace || !_garbage.empty()) _reclaim();
+
     // queue is full
     if (a->capacity() - 1 < (b - t)) {
-        Array *tmp = a->resize(b, t);
-        _garbage.push_back(a);
-        std::swap(a, tmp);
-        _array.store(a, std::memory_order_relaxed);
+        Array *tmp = a->resize(b, t, 2 * a->capacity());
+        _retire(a, tmp);
+        a = tmp;
     }
 
     a->push(b, std::forward<O>(o));
@@ -200,6 +245,9 @@ void WorkStealingQueue<T>::push(O &&o) {
 // Function: pop
 template<typename T>
 std::optional<T> WorkStealingQueue<T>::pop() {
+    if (Array *a = _array.load(std::memory_order_relaxed); a->capacity() > _initial) _try_shrink(a);
+    if (_grace || !_garbage.empty()) _reclaim();
+
     int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
     Array *a = _array.load(std::memory_order_relaxed);
     _bottom.store(b, std::memory_order_relaxed);
@@ -229,6 +277,13 @@ std::optional<T> WorkStealingQueue<T>::pop() {
 // Function: steal
 template<typename T>
 std::optional<T> WorkStealingQueue<T>::steal() {
+    // an empty queue is the common case for thieves, turn them away before they announce themselves
+    if (empty()) {
+        return std::nullopt;
+    }
+
+    _Announce announce{*this};
+
     int64_t t = _top.load(std::memory_order_acquire);
     std::atomic_thread_fence(std::memory_order_seq_cst);
     int64_t b = _bottom.load(std::memory_order_acquire);
@@ -236,7 +291,7 @@ std::optional<T> WorkStealingQueue<T>::steal() {
     std::optional<T> item;
 
     if (t < b) {
-        Array *a = _array.load(std::memory_order_consume);
+        Array *a = _array.load(std::memory_order_seq_cst);
         item = a->pop(t);
         if (!_top.compare_exchange_strong(t, t + 1,
                                           std::memory_order_seq_cst,
@@ -248,8 +303,92 @@ std::optional<T> WorkStealingQueue<T>::steal() {
     return item;
 }
 
+// Function: steal_batch
+template<typename T>
+template<typename O>
+size_t WorkStealingQueue<T>::steal_batch(O &&out, size_t max) {
+    if (empty()) {
+        return 0;
+    }
+
+    _Announce announce{*this};
+
+    size_t n = 0, limit = max;
+    while (n < limit) {
+        int64_t t = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = _bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            break;
+        }
+        if (n == 0) {
+            // half of what is there when the batch starts, rounded up
+            limit = std::min(max, static_cast<size_t>(b - t + 1) / 2);
+        }
+        Array *a = _array.load(std::memory_order_seq_cst);
+        T item = a->pop(t);
+        // a failed claim means someone else took that item, so there is progress and we try again
+        if (_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            out(std::move(item));
+            ++n;
+        }
+    }
+    return n;
+}
+
 // Function: capacity
 template<typename T>
 int64_t WorkStealingQueue<T>::capacity() const noexcept {
     return _array.load(std::memory_order_relaxed)->capacity();
 }
+
+// Function: _retire
+// publishes the replacement array and queues the old one for reclamation
+template<typename T>
+void WorkStealingQueue<T>::_retire(Array *old, Array *now) {
+    _garbage.push_back(old);
+    _array.store(now, std::memory_order_seq_cst);
+    _reclaim();
+}
+
+// Function: _reclaim
+// advances the grace period without blocking. once the parity in use before each of two flips drained, every
+// thief that could have loaded an array retired before the first flip is gone, as later ones see a newer array
+template<typename T>
+void WorkStealingQueue<T>::_reclaim() noexcept {
+    if (_grace == 0) {
+        if (_garbage.empty()) {
+            return;
+        }
+        _draining.swap(_garbage);
+    } else if (_stealers[(_epoch.load(std::memory_order_relaxed) - 1) & 1].load(std::memory_order_seq_cst) != 0) {
+        return;
+    } else if (_grace == 2) {
+        for (auto a: _draining) {
+            delete a;
+        }
+        _draining.clear();
+        _grace = 0;
+        return;
+    }
+    _epoch.fetch_add(1, std::memory_order_seq_cst);
+    ++_grace;
+}
+
+// Function: _try_shrink
+// halves a grown array after it stayed under a quarter full for a window of owner pops. a shrink only copies
+// the few items left, so the window does not need to grow with the capacity
+template<typename T>
+void WorkStealingQueue<T>::_try_shrink(Array *a) {
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_acquire);
+    if ((b - t) * 4 >= a->capacity()) {
+        _idle = 0;
+        return;
+    }
+    if (++_idle < 1024) {
+        return;
+    }
+    _idle = 0;
+    _retire(a, a->resize(b, t, a->capacity() / 2));
+}
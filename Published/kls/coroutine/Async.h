@@ -23,9 +23,11 @@
 #pragma once
 
 #include <exception>
+#include <type_traits>
 #include "Trigger.h"
 #include "Executor.h"
 #include "ValueStore.h"
+#include "Cancellation.h"
 
 namespace kls::coroutine {
     template<class T, class ContControl>
@@ -102,7 +104,11 @@ namespace kls::coroutine {
         class FlexAwaitCore : ExecutorAwaitEntry {
         public:
             explicit FlexAwaitCore(StateHandle state) : m_state(state) {}
-            FlexAwaitCore(StateHandle state, IExecutor *next) noexcept: ExecutorAwaitEntry(next), m_state(state) {}
+            template<class Exec>
+            FlexAwaitCore(StateHandle state, Exec *next) noexcept: ExecutorAwaitEntry(next), m_state(state) {}
+            template<class Exec>
+            FlexAwaitCore(StateHandle state, Exec *next, Deadline deadline) noexcept:
+                    ExecutorAwaitEntry(next, deadline), m_state(state) {}
             bool trap(std::coroutine_handle<> h) { return (set_handle(h), m_state->trap(this)); }
             T get() { return m_state->copy(); }
         private:
@@ -126,8 +132,17 @@ namespace kls::coroutine {
         FlexAsync &operator=(const FlexAsync &) noexcept = default;
         auto operator co_await()&& { return MyAwait(std::move(m_state)); }
         auto operator co_await() const& { return MyAwait(m_state); }
-        auto configure(IExecutor *next) &&{ return MyAwait(std::move(m_state), next); }
-        auto configure(IExecutor *next) const &{ return MyAwait(m_state, next); }
+        // configure<Exec> resumes through a post function calling the enqueue of Exec, see ExecutorAwaitEntry
+        template<class Exec = IExecutor>
+        auto configure(std::type_identity_t<Exec> *next) &&{ return MyAwait(std::move(m_state), next); }
+        template<class Exec = IExecutor>
+        auto configure(std::type_identity_t<Exec> *next) const &{ return MyAwait(m_state, next); }
+        template<class Exec = IExecutor>
+        auto configure(std::type_identity_t<Exec> *next, Deadline deadline) &&{
+            return MyAwait(std::move(m_state), next, deadline);
+        }
+        template<class Exec = IExecutor>
+        auto configure(std::type_identity_t<Exec> *next, Deadline deadline) const &{ return MyAwait(m_state, next, deadline); }
         operator bool() const noexcept { return m_state; } //NOLINT
     private:
         StateHandle m_state;
@@ -139,6 +154,7 @@ namespace kls::coroutine {
 namespace kls::coroutine::detail {
     struct LazyAsyncControl : private FifoExecutorTrigger {
         bool trap(FifoExecutorAwaitEntry *next) noexcept { return FifoExecutorTrigger::trap(*next); }
+        bool cancel(FifoExecutorAwaitEntry *next) noexcept { return FifoExecutorTrigger::cancel(*next); }
         void resume() noexcept { FifoExecutorTrigger::pull(); }
     };
 
@@ -180,9 +196,15 @@ namespace kls::coroutine {
         class LazyAwaitCore : FifoExecutorAwaitEntry {
         public:
             explicit LazyAwaitCore(StateHandle state) : m_state(state) {}
-            LazyAwaitCore(StateHandle state, IExecutor* next) noexcept : FifoExecutorAwaitEntry(next), m_state(state) {}
+            template<class Exec>
+            LazyAwaitCore(StateHandle state, Exec* next) noexcept : FifoExecutorAwaitEntry(next), m_state(state) {}
+            template<class Exec>
+            LazyAwaitCore(StateHandle state, Exec* next, Deadline deadline) noexcept :
+                    FifoExecutorAwaitEntry(next, deadline), m_state(state) {}
             bool trap(std::coroutine_handle<> h) { return (set_handle(h), m_state->trap(this)); }
+            bool cancel() noexcept { return m_state->cancel(this); }
             decltype(auto) get() { return m_state->ref(); }
+            using FifoExecutorAwaitEntry::resume_async;
         private:
             StateHandle m_state;
         };
@@ -199,7 +221,19 @@ namespace kls::coroutine {
         };
 
         auto operator co_await() { return MyAwait(&m_state); }
-        auto configure(IExecutor* next) { return MyAwait(&m_state, next); }
+        template<class Exec = IExecutor>
+        auto configure(std::type_identity_t<Exec>* next) { return MyAwait(&m_state, next); }
+        template<class Exec = IExecutor>
+        auto configure(std::type_identity_t<Exec>* next, Deadline deadline) { return MyAwait(&m_state, next, deadline); }
+        // the wait throws OperationCancelled once the token is cancelled, the task itself is not affected
+        auto cancellable(CancellationToken token) {
+            return detail::CancellableAwait<LazyAwaitCore>(std::move(token), &m_state);
+        }
+        // as above, resuming on next. with next set to nullptr the waiter resumes wherever the task completes or
+        // the token is cancelled
+        auto cancellable(CancellationToken token, IExecutor* next) {
+            return detail::CancellableAwait<LazyAwaitCore>(std::move(token), &m_state, next);
+        }
     private:
         State m_state;
 
@@ -212,6 +246,7 @@ namespace kls::coroutine::detail {
     struct ValueAsyncControl: AddressSensitive {
         void resume() noexcept { m_state.pull(); }
         bool trap(ExecutorAwaitEntry *next) noexcept { return m_state.trap(*next); }
+        bool cancel(ExecutorAwaitEntry *next) noexcept { return m_state.cancel(*next); }
         void drop_task() noexcept { m_lifecycle.drop(); }
         bool drop_host(std::coroutine_handle<> h) noexcept { return m_lifecycle.trap(h); }
     private:
@@ -252,10 +287,16 @@ namespace kls::coroutine {
         class ValueAwaitCore : ExecutorAwaitEntry {
         public:
             explicit ValueAwaitCore(Media* media) : mMedia(media) {}
-            ValueAwaitCore(Media* media, IExecutor* next) noexcept : ExecutorAwaitEntry(next), mMedia(media) {}
+            template<class Exec>
+            ValueAwaitCore(Media* media, Exec* next) noexcept : ExecutorAwaitEntry(next), mMedia(media) {}
+            template<class Exec>
+            ValueAwaitCore(Media* media, Exec* next, Deadline deadline) noexcept :
+                    ExecutorAwaitEntry(next, deadline), mMedia(media) {}
             ~ValueAwaitCore() { mMedia->drop_task(); }
             T get() { return mMedia->get(); }
             bool trap(std::coroutine_handle<> h) { return (set_handle(h), mMedia->trap(this)); }
+            bool cancel() noexcept { return mMedia->cancel(this); }
+            using ExecutorAwaitEntry::resume_async;
         private:
             Media* mMedia;
         };
@@ -275,7 +316,24 @@ namespace kls::coroutine {
         ValueAsync& operator=(const ValueAsync& other) = delete;
         ~ValueAsync() noexcept { if (mMedia) { mMedia->drop_task(); } }
         auto operator co_await()&& { return MyAwait(std::exchange(mMedia, nullptr)); }
-        auto configure(IExecutor* next)&& { return MyAwait(std::exchange(mMedia, nullptr), next); }
+        // resumes on next. configure<Exec> calls the enqueue of Exec itself rather than going through IExecutor
+        template<class Exec = IExecutor>
+        auto configure(std::type_identity_t<Exec>* next)&& { return MyAwait(std::exchange(mMedia, nullptr), next); }
+        // resumes on next, ordered by the given deadline if next is a deadline executor
+        template<class Exec = IExecutor>
+        auto configure(std::type_identity_t<Exec>* next, Deadline deadline)&& {
+            return MyAwait(std::exchange(mMedia, nullptr), next, deadline);
+        }
+        // once the token is cancelled the wait throws OperationCancelled, and the task is dropped
+        // as if it was never awaited
+        auto cancellable(CancellationToken token)&& {
+            return detail::CancellableAwait<ValueAwaitCore>(std::move(token), std::exchange(mMedia, nullptr));
+        }
+        // as above, resuming on next. with next set to nullptr the waiter resumes wherever the task completes or
+        // the token is cancelled
+        auto cancellable(CancellationToken token, IExecutor* next)&& {
+            return detail::CancellableAwait<ValueAwaitCore>(std::move(token), std::exchange(mMedia, nullptr), next);
+        }
         operator bool() const noexcept { return mMedia; } //NOLINT
     private:
         Media* mMedia{ nullptr };
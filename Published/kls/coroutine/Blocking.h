@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <utility>
 #include "Async.h"
 #include "Traits.h"
 
@@ -37,9 +38,30 @@ namespace kls::coroutine::detail {
 		class Executor;
 		Executor* mTheExec;
 	};
+
+	class IHelpable;
 }
 
 namespace kls::coroutine {
+    // marks blocking code run by a coroutine, such as legacy file I/O or a library holding its own locks. on a
+    // scaling executor worker another thread stands in for this one while it blocks, and retires once the section
+    // has ended. anywhere else it does nothing. the section has to end on the thread it began on, so it must not
+    // span a co_await. nested sections count once
+    class BlockingSection : public AddressSensitive {
+    public:
+        BlockingSection() noexcept;
+        ~BlockingSection() noexcept;
+    private:
+        detail::IHelpable* mPool;
+    };
+
+    // calls fn inside a BlockingSection
+    template <class Fn>
+    decltype(auto) call_blocking(Fn&& fn) {
+        BlockingSection section{};
+        return std::forward<Fn>(fn)();
+    }
+
     template <class Fn>
     auto run_blocking(Fn fn) {
         using return_type = awaitable_result_t<std::invoke_result_t<Fn>>;
@@ -47,7 +69,8 @@ namespace kls::coroutine {
         public:
             // drain the queue until the awaiting operation has completed.
             // any item submitted to the executor after the completion of the awaited
-            // item is invalid and will result in undefined behaviour
+            // item is invalid and will result in undefined behaviour.
+            // called on a scaling executor worker, the thread runs the queue of that executor while it waits
             return_type await(const Fn &fn) {
                 launch(fn);
                 start();
@@ -0,0 +1,109 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <exception>
+#include <stop_token>
+#include "Trigger.h"
+
+namespace kls::coroutine {
+    // thrown at the await point of an operation that was cancelled before it completed
+    class OperationCancelled : public std::exception {
+    public:
+        [[nodiscard]] const char *what() const noexcept override { return "operation cancelled"; }
+    };
+
+    // Observes the cancellation of a CancellationSource. A default constructed token is never cancelled.
+    class CancellationToken {
+    public:
+        CancellationToken() noexcept = default;
+        explicit CancellationToken(std::stop_token token) noexcept: m_token(std::move(token)) {}
+        [[nodiscard]] bool cancelled() const noexcept { return m_token.stop_requested(); }
+        [[nodiscard]] bool cancellable() const noexcept { return m_token.stop_possible(); }
+        void throw_if_cancelled() const { if (cancelled()) throw OperationCancelled{}; }
+        [[nodiscard]] const std::stop_token &native() const noexcept { return m_token; }
+    private:
+        std::stop_token m_token{};
+    };
+
+    class CancellationSource {
+    public:
+        [[nodiscard]] CancellationToken token() const noexcept { return CancellationToken(m_source.get_token()); }
+        [[nodiscard]] bool cancelled() const noexcept { return m_source.stop_requested(); }
+        // returns true for the call that actually cancelled
+        bool cancel() noexcept { return m_source.request_stop(); }
+    private:
+        std::stop_source m_source{};
+    };
+}
+
+namespace kls::coroutine::detail {
+    // Awaits 'Core' like Await<Core> does, but gives the wait up when the token is cancelled. The core
+    // additionally provides cancel(), which takes its entry back from the trigger it is trapped on; only when
+    // that succeeds is the waiter resumed here, with OperationCancelled. Otherwise the trigger has already
+    // claimed the entry and the wait completes normally.
+    template<class Core>
+    class CancellableAwait : private Core {
+        enum : int { ARMING, WAITING, FIRED };
+    public:
+        template<class ...U>
+        explicit CancellableAwait(CancellationToken token, U &&... v): Core(std::forward<U>(v)...), m_token(std::move(token)) {}
+
+        [[nodiscard]] bool await_ready() noexcept { return m_cancelled = m_token.cancelled(); }
+
+        [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) {
+            if (!Core::trap(h)) return false;
+            if (!m_token.cancellable()) return true;
+            // a cancellation that fires while the callback is still being registered must not resume the
+            // coroutine from within its own await_suspend, it is picked up right below instead
+            m_callback.emplace(m_token.native(), Cancel{*this});
+            return m_state.exchange(WAITING) != FIRED;
+        }
+
+        // the callback is gone before the core lets go of its entry, a late cancellation must not reach for it.
+        // dropping it waits for a callback that is already running
+        decltype(auto) await_resume() {
+            m_callback.reset();
+            if (m_cancelled) throw OperationCancelled{};
+            return Core::get();
+        }
+    private:
+        struct Cancel {
+            CancellableAwait &self;
+            void operator()() const noexcept { self.fire(); }
+        };
+
+        CancellationToken m_token;
+        std::atomic_int m_state{ARMING};
+        bool m_cancelled{false};
+        std::optional<std::stop_callback<Cancel>> m_callback{};
+
+        void fire() noexcept {
+            if (!Core::cancel()) return;
+            m_cancelled = true;
+            if (m_state.exchange(FIRED) == WAITING) Core::resume_async();
+        }
+    };
+}
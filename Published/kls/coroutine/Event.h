@@ -0,0 +1,105 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include "Trigger.h"
+#include "kls/thread/SpinLock.h"
+
+namespace kls::coroutine {
+    // helper class for waiting on the synchronization primitives below
+    // the 'Host' class should have a ready() and a trap(FifoExecutorAwaitEntry&) function
+    template<class Host>
+    class EventAwait : public AddressSensitive {
+    public:
+        explicit EventAwait(Host &host) noexcept: m_host(host) {}
+        [[nodiscard]] bool await_ready() const noexcept { return m_host.ready(); }
+        [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) { return m_entry.set_handle(h), m_host.trap(m_entry); }
+        constexpr void await_resume() const noexcept {}
+    private:
+        Host &m_host;
+        FifoExecutorAwaitEntry m_entry{};
+    };
+
+    // A manually set and reset event. Setting the event resumes all waiters at once, and every waiter
+    // arriving while it is set passes through. The waiters are linked through their await entries,
+    // so waiting never allocates.
+    class AsyncEvent : public AddressSensitive {
+    public:
+        explicit AsyncEvent(bool set = false) noexcept;
+        ~AsyncEvent();
+        [[nodiscard]] bool ready() const noexcept;
+        bool trap(FifoExecutorAwaitEntry &entry);
+        void set();
+        void reset() noexcept;
+        auto operator co_await() noexcept { return EventAwait<AsyncEvent>{*this}; }
+    private:
+        std::atomic<void *> m_state;
+    };
+
+    // A single use countdown. All waiters are resumed as one batch when the counter reaches zero.
+    class Latch : public AddressSensitive {
+    public:
+        explicit Latch(std::ptrdiff_t count) noexcept: m_count(count), m_event(count <= 0) {}
+        void count_down(std::ptrdiff_t n = 1) { if (m_count.fetch_sub(n) == n) m_event.set(); }
+        [[nodiscard]] bool ready() const noexcept { return m_event.ready(); }
+        auto operator co_await() noexcept { return m_event.operator co_await(); }
+    private:
+        std::atomic<std::ptrdiff_t> m_count;
+        AsyncEvent m_event;
+    };
+
+    // A reusable countdown. Work is registered with add() and completed with done(), and waiters are
+    // resumed as one batch every time the counter drops to zero. The counter can be raised again
+    // afterwards for the next round.
+    class WaitGroup : public AddressSensitive {
+    public:
+        void add(std::ptrdiff_t n = 1) noexcept { m_count.fetch_add(n); }
+        void done() { if (m_count.fetch_sub(1) == 1) release(); }
+        [[nodiscard]] bool ready() const noexcept { return m_count.load() == 0; }
+        bool trap(FifoExecutorAwaitEntry &entry);
+        auto operator co_await() noexcept { return EventAwait<WaitGroup>{*this}; }
+    private:
+        std::atomic<std::ptrdiff_t> m_count{0};
+        thread::SpinLock m_lock{};
+        FifoExecutorAwaitEntry *m_head{nullptr};
+
+        void release();
+    };
+
+    // A cyclic barrier for a fixed number of parties. The last party to arrive in a phase resumes the
+    // others as one batch and the barrier is immediately ready for the next phase.
+    class Barrier : public AddressSensitive {
+    public:
+        explicit Barrier(std::ptrdiff_t parties) noexcept: m_parties(parties), m_remaining(parties) {}
+        [[nodiscard]] constexpr bool ready() const noexcept { return false; }
+        bool trap(FifoExecutorAwaitEntry &entry);
+        auto arrive_and_wait() noexcept { return EventAwait<Barrier>{*this}; }
+    private:
+        const std::ptrdiff_t m_parties;
+        std::ptrdiff_t m_remaining;
+        thread::SpinLock m_lock{};
+        FifoExecutorAwaitEntry *m_head{nullptr};
+    };
+}
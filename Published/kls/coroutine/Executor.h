@@ -22,12 +22,36 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <vector>
 #include <cassert>
+#include <concepts>
 #include <coroutine>
 #include "kls/Object.h"
 
 namespace kls::coroutine {
+    using Deadline = std::chrono::steady_clock::time_point;
+
+    class TaskTag;
+
+    class LatencyRecorder;
+
+    // link of an intrusive run queue. an awaiter embedding one lets the executor queue the suspended coroutine
+    // without allocating. it must neither move nor go away before the coroutine resumes, which holds for
+    // anything living in the suspended frame
+    struct TaskNode {
+        TaskNode* next{ nullptr };
+        void* handle{ nullptr };
+        bool pooled{ false }; // set on nodes a queue supplies itself for plain enqueues
+        const TaskTag* tag{ nullptr }; // the task is profiled under it and runs under it once dequeued
+        std::int64_t queued{ 0 }; // steady clock nanoseconds of the enqueue, only stamped while profiling or recording
+        bool woken{ false }; // the node of an awaiter a trigger resumes once its dependency completed
+    };
+
     class IExecutor {
     public:
         void enqueue(std::coroutine_handle<> handle) noexcept {
@@ -35,28 +59,134 @@ namespace kls::coroutine {
             (*this.*EnqueueRaw)(handle.address());
         }
 
+        // enqueue with an explicit deadline. executors that do not order by deadline ignore it
+        void enqueue(std::coroutine_handle<> handle, Deadline deadline) noexcept {
+            if (ByDeadline) EnqueueAt(handle, deadline); else enqueue(handle);
+        }
+
+        // enqueue through a node owned by the caller. executors without an intrusive queue are handed the node in
+        // place of the handle, the task runs under the node's tag either way
+        void enqueue(TaskNode& node, std::coroutine_handle<> handle, Deadline deadline) noexcept;
+
+        // latency histograms of this executor, see Latency.h. the first call creates them and starts recording,
+        // they stay with the executor from then on
+        LatencyRecorder& latency();
+
+        // nullptr until latency() has been called
+        [[nodiscard]] LatencyRecorder* latency_recorder() const noexcept { return mLatency.load(std::memory_order_acquire); }
+
+        ~IExecutor() noexcept;
+
     protected:
         using FnEnqueue = void (IExecutor::*)(void* coroutine) noexcept;
+        using FnEnqueueNode = void (IExecutor::*)(TaskNode* node) noexcept;
 
-        explicit IExecutor(FnEnqueue enqueue) : EnqueueRaw{ enqueue } {}
+        // an executor ordering by deadline reads this_deadline() when enqueued, the others are never handed one
+        explicit IExecutor(FnEnqueue enqueue, FnEnqueueNode link = nullptr, bool by_deadline = false) :
+            EnqueueRaw{ enqueue }, EnqueueNode{ link }, ByDeadline{ by_deadline } {}
 
     private:
         FnEnqueue EnqueueRaw;
+        FnEnqueueNode EnqueueNode;
+        const bool ByDeadline;
+        std::atomic<LatencyRecorder*> mLatency{ nullptr };
+
+        void EnqueueAt(std::coroutine_handle<> handle, Deadline deadline) noexcept;
     };
 
+    namespace detail {
+        // an executor type more concrete than IExecutor, which may define an enqueue of its own
+        template<class Exec>
+        concept TypedExecutor = std::derived_from<Exec, IExecutor> && !std::same_as<Exec, IExecutor>;
+
+        using FnPost = void (*)(IExecutor* exec, TaskNode& node, std::coroutine_handle<> handle, Deadline deadline) noexcept;
+
+        // calls the enqueue of Exec itself, which is inlined here. awaiters keep a pointer to it rather than the
+        // type, so the call into it is only direct where the awaiter is made and used in one place, as SwitchTo is
+        template<class Exec>
+        void Post(IExecutor* exec, TaskNode& node, std::coroutine_handle<> handle, Deadline deadline) noexcept {
+            static_cast<Exec*>(exec)->enqueue(node, handle, deadline);
+        }
+    }
+
     IExecutor* this_executor() noexcept;
 
+    // deadline of the task running on this thread, Deadline::max() if it has none.
+    // plain enqueue calls made from this thread inherit it
+    Deadline this_deadline() noexcept;
+
+    // tag of the task running on this thread, see Profile.h. nullptr if it has none
+    const TaskTag* this_tag() noexcept;
+
+    // runs the scope under tag, coroutines started in it keep the tag across their suspensions. it must not be
+    // held across a suspension itself, SwitchTo can retag a running coroutine instead
+    class TagScope {
+    public:
+        explicit TagScope(const TaskTag& tag) noexcept;
+        TagScope(const TagScope&) = delete;
+        TagScope& operator=(const TagScope&) = delete;
+        ~TagScope() noexcept;
+    private:
+        const TaskTag* mLast;
+    };
+
     std::shared_ptr<IExecutor> CreateSingleThreadExecutor();
 
+    // low latency variant for a dedicated core. once the queue runs empty the thread keeps polling it for up to
+    // 'spin' before parking (nanoseconds::max() never parks), so hand-offs meanwhile need no wake-up.
+    // a non-negative cpu pins the thread to that core
+    std::shared_ptr<IExecutor> CreateSingleThreadExecutor(std::chrono::nanoseconds spin, int cpu = -1);
+
+    // linger is in milliseconds. Scaling.h has overloads taking a scaling policy and returning a runtime handle
     std::shared_ptr<IExecutor> CreateScalingFIFOExecutor(int min, int max, int linger);
 
     std::shared_ptr<IExecutor> CreateScalingBagExecutor(int min, int max, int linger);
 
+    // runs the task with the earliest deadline first. with demote_expired set, tasks found past their
+    // deadline are moved to a low priority lane that only runs when no on-time task is ready
+    std::shared_ptr<IExecutor> CreateScalingDeadlineExecutor(int min, int max, int linger, bool demote_expired = true);
+
+    // shared-nothing runtime of one thread per shard. a shard runs work enqueued from its own thread from a
+    // private queue without any atomics, and work from other shards arrives through one single-producer ring
+    // per sending shard, drained in batches. other threads go through a locked queue
+    class ShardedExecutor: public AddressSensitive {
+    public:
+        // with pin set, shard i is pinned to core i modulo the core count
+        explicit ShardedExecutor(int n, bool pin = true);
+        ~ShardedExecutor();
+        [[nodiscard]] int size() const noexcept;
+        [[nodiscard]] IExecutor* shard(int i) const noexcept;
+    private:
+        class Shard;
+        std::vector<Shard*> mShards;
+    };
+
+    std::shared_ptr<ShardedExecutor> CreateShardedExecutor(int n, bool pin = true);
+
+    // index of the shard the calling thread runs, -1 if it is not a shard thread
+    int this_shard() noexcept;
+
     class ManualDrainExecutor: public AddressSensitive {
     public:
+        struct DrainResult {
+            std::size_t ran; // number of tasks resumed by the call
+            bool remaining; // whether the queue still had work when the call returned
+        };
+
         ManualDrainExecutor();
         ~ManualDrainExecutor();
+        [[nodiscard]] IExecutor* executor() const noexcept;
+        // runs until the queue is empty, including work enqueued meanwhile
         void drain_once();
+        // runs tasks until the queue is empty or the time point has passed. the clock is checked before each task,
+        // so a single long task can still overrun it
+        DrainResult drain_until(Deadline deadline);
+        template<class Rep, class Period>
+        DrainResult drain_for(std::chrono::duration<Rep, Period> budget) {
+            return drain_until(std::chrono::steady_clock::now() + std::chrono::ceil<Deadline::duration>(budget));
+        }
+        // runs at most count tasks
+        DrainResult drain_n(std::size_t count);
     private:
         class Executor;
         Executor* mTheExec;
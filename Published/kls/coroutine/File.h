@@ -0,0 +1,134 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <span>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include "Async.h"
+#include "Generator.h"
+
+namespace kls::coroutine {
+    // runs the blocking file operations below so that they never hold up a worker of another executor.
+    // it is a scaling executor of its own, shared by the process
+    IExecutor* file_executor();
+
+    namespace detail { struct FileAccess; }
+
+    enum class FileMode {
+        Read, // an existing file, read only
+        Write, // created or truncated, write only
+        Update // created if missing, read and write
+    };
+
+    // a file whose operations run on file_executor(). the awaiting coroutine resumes on its own executor
+    // afterwards, and failures are thrown as std::system_error. the file has to stay open until every
+    // operation on it has completed
+    class File {
+    public:
+        File() noexcept = default;
+        File(File &&other) noexcept;
+        File &operator=(File &&other) noexcept;
+        File(const File &) = delete;
+        File &operator=(const File &) = delete;
+        // closes on the calling thread
+        ~File() noexcept;
+
+        static ValueAsync<File> open(std::filesystem::path path, FileMode mode);
+
+        [[nodiscard]] bool is_open() const noexcept { return mHandle != -1; }
+
+        // fills the buffer unless the end of the file comes first, returns the number of bytes read
+        ValueAsync<std::size_t> read_at(std::uint64_t offset, std::span<std::byte> buffer) const;
+
+        // writes all of data, returns its size
+        ValueAsync<std::size_t> write_at(std::uint64_t offset, std::span<const std::byte> data) const;
+
+        ValueAsync<void> fsync() const;
+
+        ValueAsync<std::uint64_t> size() const;
+
+    private:
+        friend struct detail::FileAccess;
+        // a file descriptor, or a HANDLE on windows
+        std::intptr_t mHandle{-1};
+
+        explicit File(std::intptr_t handle) noexcept: mHandle(handle) {}
+    };
+
+    struct ReadStreamOptions {
+        std::uint64_t offset{0};
+        std::size_t chunk{1u << 20}; // bytes per item, the last one may be shorter
+        std::size_t depth{2}; // chunks read ahead of the consumer
+        // maps the file and hands out views of the mapping. the kernel is asked to page in the chunks ahead,
+        // which suits sequential scans of files that may be larger than the buffers would be
+        bool mapped{false};
+    };
+
+    // the items of read_stream, consumed as those of an AsyncGenerator. unlike one it may be dropped before its
+    // end: the producer is then told to stop at its next yield, and gives its buffers back once the reads it
+    // has in flight have settled. that happens after the stream is gone, the file has to stay open until then
+    class ReadStream {
+    public:
+        using Item = std::span<const std::byte>;
+
+        class ForwardAwait {
+        public:
+            explicit ForwardAwait(ReadStream &stream) noexcept: m_stream(stream), m_await(stream.m_items.forward()) {}
+            [[nodiscard]] bool await_ready() noexcept { return m_await.await_ready(); }
+            [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) { return m_await.await_suspend(h); }
+            // the producer frame is gone once it has run to its end, failed or not
+            [[nodiscard]] bool await_resume() {
+                try { if (m_await.await_resume()) return true; } catch (...) { m_stream.m_stop.reset(); throw; }
+                return m_stream.m_stop.reset(), false;
+            }
+        private:
+            ReadStream &m_stream;
+            AsyncGenerator<Item>::forward_await m_await;
+        };
+
+        ReadStream(ReadStream &&other) noexcept: m_items(other.m_items), m_stop(std::move(other.m_stop)) {}
+        ReadStream &operator=(ReadStream &&) = delete;
+        ~ReadStream() noexcept;
+
+        [[nodiscard]] ForwardAwait forward() noexcept { return ForwardAwait(*this); }
+        [[nodiscard]] Item next() { return m_items.next(); }
+    private:
+        friend ReadStream read_stream(const File &file, ReadStreamOptions options);
+
+        ReadStream(AsyncGenerator<Item> items, std::unique_ptr<std::atomic_bool> stop) noexcept:
+                m_items(items), m_stop(std::move(stop)) {}
+
+        AsyncGenerator<Item> m_items;
+        // looked at by the producer after every yield. empty once the producer has ended, or moved from
+        std::unique_ptr<std::atomic_bool> m_stop;
+    };
+
+    // streams the file from offset to its end. unmapped, depth reads are kept in flight on file_executor()
+    // while the consumer works, in buffers taken from a pool shared by all streams. each item stays valid
+    // until the next one is asked for. the file has to outlive the stream, and its reads if it is dropped early
+    ReadStream read_stream(const File &file, ReadStreamOptions options = {});
+}
@@ -22,15 +22,61 @@
 
 #pragma once
 
+#include <bit>
+#include <atomic>
 #include <memory>
+#include <ranges>
 #include <iterator>
+#include <type_traits>
 #include "Trigger.h"
 #include "ValueStore.h"
 #include "kls/essential/Final.h"
 
 namespace kls::coroutine {
+    // Items of these types are borrowed from the producer: references to, or views into, objects the producer
+    // owns. They stay valid until the consumer asks for the next item, and the producer is only resumed then.
+    // Specialize for other view-like types that do not model std::ranges::view.
+    template<class T>
+    constexpr bool enable_borrowed_yield = std::is_reference_v<T> || std::ranges::view<std::remove_cv_t<T>>;
+
+    // Receives the items of an AsyncGenerator directly on the producer side, instead of them being handed over
+    // one by one through the consumer. accept returns true when the producer should suspend and pass control
+    // to the consumer, false when the item was absorbed and the producer may continue right away. Once the
+    // producer has fully suspended, after an accepted item or at its end, it hands over to the sink instead of
+    // its own consumer, and may be resumed or destroyed from there.
+    template<class T>
+    class GeneratorSink {
+    public:
+        bool accept(T &&item) { return (*this.*AcceptRaw)(std::forward<T>(item)); }
+        void hand_over() noexcept { (*this.*HandOverRaw)(); }
+    protected:
+        using FnAccept = bool (GeneratorSink::*)(T &&item);
+        using FnHandOver = void (GeneratorSink::*)() noexcept;
+
+        GeneratorSink(FnAccept accept, FnHandOver hand_over) noexcept: AcceptRaw{accept}, HandOverRaw{hand_over} {}
+    private:
+        FnAccept AcceptRaw;
+        FnHandOver HandOverRaw;
+    };
+
+    template<class T>
+    class AsyncGenerator;
+
+    namespace detail {
+        template<class T>
+        struct GeneratorAccess {
+            using promise_type = typename AsyncGenerator<T>::promise_type;
+            static promise_type *promise(AsyncGenerator<T> &gen) noexcept { return gen.m_promise; }
+            // frees a producer suspended at a yield that the consumer is not going to ask for more
+            static void drop(AsyncGenerator<T> &gen) noexcept {
+                AsyncGenerator<T>::handle_t::from_promise(*gen.m_promise).destroy();
+            }
+        };
+    }
+
     template<class T>
     class AsyncGenerator {
+        struct hand_over;
     public:
         class promise_type {
         public:
@@ -40,14 +86,20 @@ namespace kls::coroutine {
             // coroutine lifetime promise functions
             auto get_return_object() noexcept { return AsyncGenerator(this); }
             auto initial_suspend() noexcept { return std::suspend_never{}; }
-            auto final_suspend() noexcept { return std::suspend_always{}; }
+            auto final_suspend() noexcept { return hand_over{*this, true}; }
             void unhandled_exception() { m_future.fail(std::current_exception()); }
-            void return_void() { m_future.set(), m_trigger.pull(); }
+            void return_void() { m_future.set(); }
 
             // value yielding for generator
             decltype(auto) get_value() { return m_yield.get(); }
-            auto yield_value(T &&ref) noexcept(std::is_nothrow_move_constructible_v<T>) {
-                return m_yield.set(std::forward<T>(ref)), m_trigger.pull(), std::suspend_always{};
+            // a sink may throw from its stages, which then surfaces in the producer at the yield
+            auto yield_value(std::conditional_t<std::is_reference_v<T>, T, T &&> ref) {
+                if (m_sink) return hand_over{*this, m_sink->accept(std::forward<T>(ref))};
+                return m_yield.set(std::forward<T>(ref)), hand_over{*this, true};
+            }
+
+            auto yield_value(const T &ref) requires (!std::is_reference_v<T> && std::copy_constructible<T>) {
+                return yield_value(T(ref));
             }
 
             // continuation
@@ -55,11 +107,20 @@ namespace kls::coroutine {
             void reset() { m_yield.reset(), std::destroy_at(&m_trigger), std::construct_at(&m_trigger); }
             void resume() { if (auto h = handle_t::from_promise(*this); m_exec) m_exec->enqueue(h); else h.resume(); }
             void final() { m_future.get(); }
+            // only to be called while the producer is suspended
+            void attach(GeneratorSink<T> *sink) noexcept { m_sink = sink; }
+
+            // a borrowed item is given back by the consumer when it asks for the next one
+            void hold() noexcept { m_held = true; }
+            void release() { if (m_held) m_held = false, reset(), resume(); }
         private:
+            friend struct AsyncGenerator::hand_over;
             coroutine::ValueStore<T> m_yield;
             coroutine::FutureStore<void> m_future;
             coroutine::SingleExecutorTrigger m_trigger;
             coroutine::IExecutor *m_exec = coroutine::this_executor();
+            GeneratorSink<T> *m_sink{nullptr};
+            bool m_held{false};
         };
 
         using handle_t = std::coroutine_handle<promise_type>;
@@ -68,10 +129,17 @@ namespace kls::coroutine {
         public:
             explicit forward_await(promise_type *p) noexcept: m_p(*p) {}
             [[nodiscard]] constexpr bool await_ready() noexcept { return false; }
-            [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) { return m_e.set_handle(h), m_p.trap(m_e); }
+            [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) {
+                return m_p.release(), m_e.set_handle(h), m_p.trap(m_e);
+            }
             [[nodiscard]] bool await_resume() {
                 const auto done = handle_t::from_promise(m_p).done();
-                if (done) m_p.final(), handle_t::from_promise(m_p).destroy(); else m_p.reset();
+                if (done) {
+                    // the failure of the producer is rethrown from final, its frame has to go either way
+                    essential::Final final{[this]() { handle_t::from_promise(m_p).destroy(); }};
+                    m_p.final();
+                }
+                else if constexpr (enable_borrowed_yield<T>) m_p.hold();
                 return !done;
             }
         private:
@@ -80,13 +148,166 @@ namespace kls::coroutine {
         };
 
         [[nodiscard]] auto forward() noexcept { return forward_await(m_promise); }
-        [[nodiscard]] decltype(auto) next() {
-            essential::Final final{[this]() { m_promise->resume(); }};
-            return m_promise->get_value();
+        // an owned item has to leave the store before the producer is let go, as the next yield overwrites it.
+        // a borrowed item is handed out as is and the producer is let go on the next forward()
+        [[nodiscard]] T next() {
+            if constexpr (enable_borrowed_yield<T>) return m_promise->get_value();
+            else {
+                T value = m_promise->get_value();
+                m_promise->reset(), m_promise->resume();
+                return value;
+            }
         }
     private:
+        template<class> friend struct detail::GeneratorAccess;
+
+        // the consumer is only notified once the producer has fully suspended, so it may resume or destroy
+        // the producer frame as soon as it wakes up
+        struct hand_over {
+            promise_type &p;
+            bool suspend;
+            [[nodiscard]] bool await_ready() const noexcept { return !suspend; }
+            void await_suspend(std::coroutine_handle<>) const noexcept {
+                if (p.m_sink) p.m_sink->hand_over(); else p.m_trigger.pull();
+            }
+            constexpr void await_resume() const noexcept {}
+        };
+
         explicit AsyncGenerator(promise_type *promise) noexcept: m_promise(promise) {}
         promise_type *m_promise;
     };
-}
 
+    // A generator whose producer runs ahead of the consumer into a ring of Capacity items. The producer only
+    // suspends when the ring is full and is woken once the consumer has drained it down to LowWatermark.
+    // The consumer only suspends when the ring is empty. In between, items are exchanged without any
+    // executor round-trip on either side.
+    template<class T, std::size_t Capacity = 16, std::size_t LowWatermark = Capacity / 2>
+    class BufferedGenerator {
+        static_assert(Capacity > 0 && LowWatermark < Capacity);
+        static_assert(!enable_borrowed_yield<T>, "items in the ring outlive the yield, they cannot be borrowed");
+    public:
+        class promise_type {
+        public:
+            promise_type() noexcept = default;
+            ~promise_type() noexcept = default;
+
+            // coroutine lifetime promise functions
+            auto get_return_object() noexcept { return BufferedGenerator(this); }
+            auto initial_suspend() noexcept { return std::suspend_never{}; }
+            auto final_suspend() noexcept { return final_await{*this}; }
+            void unhandled_exception() { m_future.fail(std::current_exception()); }
+            void return_void() { m_future.set(); }
+
+            // value yielding for generator
+            auto yield_value(T &&ref) noexcept(std::is_nothrow_move_constructible_v<T>) {
+                const auto tail = m_tail.load(std::memory_order_relaxed);
+                m_ring[tail % Capacity].set(std::forward<T>(ref));
+                m_tail.store(tail + 1);
+                return wake_consumer(), yield_await{*this};
+            }
+
+            // consumer side
+            [[nodiscard]] bool available() const noexcept { return readable() || m_consumer.load() == done_ptr(); }
+            [[nodiscard]] bool readable() const noexcept { return m_head.load() != m_tail.load(); }
+
+            bool trap(coroutine::ExecutorAwaitEntry &h) {
+                void *expected = nullptr;
+                if (!m_consumer.compare_exchange_strong(expected, &h)) return false; // the producer has finished
+                if (!readable()) return true;
+                // something arrived in the meantime, try to take the entry back
+                expected = &h;
+                return !m_consumer.compare_exchange_strong(expected, nullptr);
+            }
+
+            T take() {
+                const auto head = m_head.load(std::memory_order_relaxed);
+                auto &slot = m_ring[head % Capacity];
+                T value = slot.get();
+                slot.reset();
+                m_head.store(head + 1);
+                if (m_tail.load() - (head + 1) <= LowWatermark) wake_producer();
+                return value;
+            }
+
+            void final() { m_future.get(); }
+        private:
+            struct yield_await {
+                promise_type &p;
+                [[nodiscard]] bool await_ready() const noexcept { return p.m_tail.load() - p.m_head.load() < Capacity; }
+                [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) noexcept { return p.park(h); }
+                constexpr void await_resume() const noexcept {}
+            };
+
+            struct final_await {
+                promise_type &p;
+                [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+                // the consumer may destroy the frame as soon as it sees the mark, so it is published once suspended
+                // with a single exchange and the frame is not touched after that
+                void await_suspend(std::coroutine_handle<>) noexcept {
+                    if (auto h = p.m_consumer.exchange(done_ptr()); h) static_cast<coroutine::ExecutorAwaitEntry *>(h)->resume_async();
+                }
+                constexpr void await_resume() const noexcept {}
+            };
+
+            coroutine::ValueStore<T> m_ring[Capacity];
+            std::atomic_size_t m_head{0}, m_tail{0};
+            std::atomic<void *> m_consumer{nullptr}, m_producer{nullptr};
+            coroutine::FutureStore<void> m_future;
+            coroutine::IExecutor *m_exec = coroutine::this_executor();
+
+            // marks the consumer slot once the producer has run to completion
+            static void *done_ptr() noexcept { return std::bit_cast<void *>(~uintptr_t(0)); }
+
+            // left in the producer slot by a consumer that drained the ring while the producer was running
+            static void *more_ptr() noexcept { return std::bit_cast<void *>(~uintptr_t(1)); }
+
+            // the frame can be resumed and destroyed by the consumer once the handle is out, so the ring is only
+            // looked at before publishing it
+            bool park(std::coroutine_handle<> h) noexcept {
+                for (;;) {
+                    void *expected = nullptr;
+                    if (m_producer.compare_exchange_strong(expected, h.address())) return true;
+                    // the request may predate the ring filling up, so it is dropped and the ring checked again
+                    m_producer.store(nullptr);
+                    if (m_tail.load() - m_head.load() < Capacity) return false;
+                }
+            }
+
+            void wake_consumer() {
+                if (!m_consumer.load()) return;
+                if (auto h = m_consumer.exchange(nullptr); h) static_cast<coroutine::ExecutorAwaitEntry *>(h)->resume_async();
+            }
+
+            void wake_producer() {
+                if (m_producer.load() == more_ptr()) return;
+                if (auto h = m_producer.exchange(more_ptr()); h && h != more_ptr()) {
+                    const auto handle = std::coroutine_handle<>::from_address(h);
+                    if (m_exec) m_exec->enqueue(handle); else handle.resume();
+                }
+            }
+        };
+
+        using handle_t = std::coroutine_handle<promise_type>;
+
+        class forward_await : public AddressSensitive {
+        public:
+            explicit forward_await(promise_type *p) noexcept: m_p(*p) {}
+            [[nodiscard]] bool await_ready() noexcept { return m_p.available(); }
+            [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) { return m_e.set_handle(h), m_p.trap(m_e); }
+            [[nodiscard]] bool await_resume() {
+                if (m_p.readable()) return true;
+                essential::Final final{[this]() { handle_t::from_promise(m_p).destroy(); }};
+                return m_p.final(), false;
+            }
+        private:
+            promise_type &m_p;
+            coroutine::ExecutorAwaitEntry m_e;
+        };
+
+        [[nodiscard]] auto forward() noexcept { return forward_await(m_promise); }
+        [[nodiscard]] T next() { return m_promise->take(); }
+    private:
+        explicit BufferedGenerator(promise_type *promise) noexcept: m_promise(promise) {}
+        promise_type *m_promise;
+    };
+}
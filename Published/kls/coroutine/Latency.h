@@ -0,0 +1,118 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "Executor.h"
+
+namespace kls::coroutine {
+    // log-linear histogram of nanosecond latencies. values are kept to within 1/32 of themselves up to 2^42ns,
+    // about 73 minutes, larger ones are clamped to that
+    class LatencyHistogram {
+    public:
+        static constexpr int SubBits = 6;
+        static constexpr int MaxBits = 42;
+        static constexpr int Buckets = (1 << SubBits) + (MaxBits - SubBits) * (1 << (SubBits - 1));
+
+        LatencyHistogram();
+
+        void record(std::chrono::nanoseconds value) noexcept;
+
+        void merge(const LatencyHistogram &other) noexcept;
+
+        [[nodiscard]] std::uint64_t count() const noexcept { return mCount; }
+
+        [[nodiscard]] std::chrono::nanoseconds max() const noexcept { return std::chrono::nanoseconds(mMax); }
+
+        [[nodiscard]] std::chrono::nanoseconds mean() const noexcept;
+
+        // the value at quantile q in [0, 1], reported as the highest value of its bucket. zero if nothing is recorded
+        [[nodiscard]] std::chrono::nanoseconds percentile(double q) const noexcept;
+
+        [[nodiscard]] std::chrono::nanoseconds p50() const noexcept { return percentile(0.5); }
+
+        [[nodiscard]] std::chrono::nanoseconds p99() const noexcept { return percentile(0.99); }
+
+        [[nodiscard]] std::chrono::nanoseconds p999() const noexcept { return percentile(0.999); }
+    private:
+        friend class LatencyRecorder;
+        std::vector<std::uint64_t> mCounts;
+        std::uint64_t mCount{0};
+        std::int64_t mSum{0}, mMax{0};
+
+        [[nodiscard]] static int BucketOf(std::int64_t value) noexcept;
+
+        // the highest value counted into the bucket
+        [[nodiscard]] static std::int64_t BucketTop(int bucket) noexcept;
+
+        void Add(int bucket, std::uint64_t count) noexcept;
+
+        void AddTotals(std::int64_t sum, std::int64_t max) noexcept;
+    };
+
+    struct LatencyReport {
+        // enqueue to resume. only FIFO queues keep the enqueue stamp, tasks from the bag and the deadline queues
+        // are left out
+        LatencyHistogram wait;
+        // resume to the next suspension
+        LatencyHistogram run;
+        // the part of wait spent by awaiters a trigger has queued back onto this executor once their dependency
+        // completed. waiters resumed inline by the trigger do not wait and are not counted
+        LatencyHistogram wake;
+    };
+
+    // latency histograms of one executor, one set per worker so recording does not contend, merged on read. the
+    // executor feeds it once obtained from IExecutor::latency, executors of other kinds can call the record
+    // functions themselves
+    class LatencyRecorder : public AddressSensitive {
+    public:
+        LatencyRecorder();
+
+        ~LatencyRecorder();
+
+        // recording stamps every enqueue in the process, so it can be paused when not looked at
+        void enable(bool on) noexcept;
+
+        [[nodiscard]] bool enabled() const noexcept { return mOn.load(std::memory_order_relaxed); }
+
+        // merges the workers. with reset set the counts read are taken out, so the next report starts from there
+        [[nodiscard]] LatencyReport collect(bool reset = true);
+
+        void record_wait(std::chrono::nanoseconds value) noexcept;
+
+        void record_run(std::chrono::nanoseconds value) noexcept;
+
+        void record_wake(std::chrono::nanoseconds value) noexcept;
+    private:
+        struct Shard;
+        std::atomic_bool mOn{false};
+        int mShards;
+        std::unique_ptr<Shard[]> mShard;
+
+        Shard &Local() noexcept;
+    };
+}
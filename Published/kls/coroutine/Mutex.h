@@ -24,27 +24,68 @@
 
 #include <mutex>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include "Executor.h"
+#include "Cancellation.h"
 
 namespace kls::coroutine {
     class Mutex;
 
+    namespace detail {
+        class MutexTicket;
+        class MutexWaitCore;
+    }
+
+    // Decides how the ownership of the mutex is passed on when it is unlocked with waiters queued
+    enum class MutexHandoff {
+        // the next waiter is enqueued on its executor, and the unlocking coroutine continues
+        Enqueue,
+        // the next waiter is resumed in place if it runs on the same executor as the unlocking coroutine
+        Inline,
+        // the mutex is released to acquirers that are spinning on it, queued waiters are served afterwards
+        Barging
+    };
+
+    struct MutexStatistics {
+        std::uint64_t acquisitions;
+        std::uint64_t contended;
+        std::chrono::nanoseconds wait_time;
+    };
+
     class MutexAcquire {
     public:
         explicit MutexAcquire(Mutex &mutex) noexcept: m_mutex(mutex) {}
-        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+        [[nodiscard]] bool await_ready() noexcept;
         [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) noexcept;
-        Mutex &await_resume() const noexcept { return m_mutex; } // NOLINT, can discard
+        Mutex &await_resume() noexcept; // NOLINT, can discard
     private:
         friend class Mutex;
+        friend class MutexUnlock;
+        friend class detail::MutexTicket;
+        friend class detail::MutexWaitCore;
 
-        void resume() { if (m_exec) m_exec->enqueue(m_handle); else m_handle.resume(); }
+        void resume();
+        bool claim() noexcept;
 
         Mutex &m_mutex;
         MutexAcquire *m_next{};
         IExecutor *m_exec{this_executor()};
         std::coroutine_handle<> m_handle{};
+        std::chrono::steady_clock::time_point m_since{};
+        bool m_ticket{false};
+    };
+
+    // Unlocks the mutex and, if the next waiter runs on the current executor, transfers control to it directly.
+    // The unlocking coroutine is then enqueued on its executor instead of continuing.
+    class MutexUnlock {
+    public:
+        explicit MutexUnlock(Mutex &mutex) noexcept: m_mutex(mutex) {}
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+        [[nodiscard]] std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept;
+        constexpr void await_resume() const noexcept {}
+    private:
+        Mutex &m_mutex;
     };
 
     class MutexLock {
@@ -61,39 +102,99 @@ namespace kls::coroutine {
     class ScopedMutexAcquire {
     public:
         explicit ScopedMutexAcquire(Mutex &mutex) noexcept: m_acquire(mutex) {}
-        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+        [[nodiscard]] bool await_ready() noexcept { return m_acquire.await_ready(); }
         [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) noexcept { return m_acquire.await_suspend(h); }
-        [[nodiscard]] MutexLock await_resume() const noexcept {
+        [[nodiscard]] MutexLock await_resume() noexcept {
             return MutexLock{m_acquire.await_resume(), std::adopt_lock};
         }
     private:
         MutexAcquire m_acquire;
     };
 
+    namespace detail {
+        // The queued entry of a cancellable acquisition. A waiter that gives up moves on without taking the
+        // entry out of the mutex, so it lives on the heap until an unlock dequeues it: whichever of the two
+        // claims it first decides whether the lock is handed over or the entry is freed and skipped.
+        class MutexTicket : public MutexAcquire {
+        public:
+            explicit MutexTicket(const MutexAcquire &acquire) noexcept: MutexAcquire(acquire) { m_ticket = true; }
+            bool grant() noexcept { return settle(GRANTED); }
+            bool cancel() noexcept { return settle(CANCELLED); }
+        private:
+            enum : int { WAITING, GRANTED, CANCELLED };
+            std::atomic_int m_state{WAITING};
+
+            bool settle(int to) noexcept {
+                auto expected = int(WAITING);
+                return m_state.compare_exchange_strong(expected, to);
+            }
+        };
+
+        class MutexWaitCore {
+        public:
+            explicit MutexWaitCore(Mutex &mutex) noexcept: m_acquire(mutex) {}
+
+            bool trap(std::coroutine_handle<> h);
+
+            bool cancel() noexcept { return m_ticket->cancel(); }
+
+            Mutex &get() noexcept;
+
+            // the ticket may already be gone once cancelled, the waiter is resumed from its own copy
+            void resume_async() { m_acquire.resume(); }
+        private:
+            MutexAcquire m_acquire;
+            MutexTicket *m_ticket{nullptr};
+        };
+
+        class ScopedMutexWaitCore : public MutexWaitCore {
+        public:
+            using MutexWaitCore::MutexWaitCore;
+            MutexLock get() noexcept { return MutexLock{MutexWaitCore::get(), std::adopt_lock}; }
+        };
+    }
+
+    // give the wait for the lock up when the token is cancelled, with OperationCancelled
+    using CancellableMutexAcquire = detail::CancellableAwait<detail::MutexWaitCore>;
+    using CancellableScopedMutexAcquire = detail::CancellableAwait<detail::ScopedMutexWaitCore>;
+
     // This is basically the same stuff from cppcoro, except that we backed in the executor
     class Mutex {
     public:
-        Mutex() noexcept;
+        // spin is the number of attempts an acquirer makes before it queues itself and suspends
+        explicit Mutex(MutexHandoff handoff = MutexHandoff::Enqueue, int spin = 0) noexcept;
         ~Mutex();
         bool try_lock() noexcept;
         MutexAcquire lock_async() noexcept { return MutexAcquire{*this}; }
         ScopedMutexAcquire scoped_lock_async() noexcept { return ScopedMutexAcquire{*this}; }
+        CancellableMutexAcquire lock_async(CancellationToken token) noexcept {
+            return CancellableMutexAcquire(std::move(token), *this);
+        }
+        CancellableScopedMutexAcquire scoped_lock_async(CancellationToken token) noexcept {
+            return CancellableScopedMutexAcquire(std::move(token), *this);
+        }
+        MutexUnlock unlock_async() noexcept { return MutexUnlock{*this}; }
         void unlock();
+        [[nodiscard]] MutexStatistics statistics() const noexcept;
     private:
         friend class MutexAcquire;
+        friend class MutexUnlock;
 
         static constexpr std::uintptr_t not_locked = 1;
         static constexpr std::uintptr_t locked_no_waiters = 0;
 
         // This field provides synchronisation for the mutex.
         //
-        // It can have three kinds of values:
+        // It can have four kinds of values:
         // - not_locked
         // - locked_no_waiters
         // - a pointer to the head of a singly linked list of recently
         //   queued MutexAcquire objects. This list is
         //   in most-recently-queued order as new items are pushed onto
         //   the front of the list.
+        // - a pointer as above with the not_locked bit set. This only
+        //   happens in barging mode, when the lock has been released to
+        //   spinning acquirers while waiters are still queued.
         std::atomic<std::uintptr_t> m_state;
 
         // Linked list of async lock operations that are waiting to acquire
@@ -101,5 +202,16 @@ namespace kls::coroutine {
         // they appear in this list. Waiters in this list will acquire the
         // mutex before waiters added to the m_newWaiters list.
         MutexAcquire *m_waiters;
+
+        const MutexHandoff m_handoff;
+        const int m_spin;
+        std::atomic_int m_spinning{0};
+
+        std::atomic<std::uint64_t> m_acquisitions{0}, m_contended{0}, m_wait_ns{0};
+
+        bool try_acquire() noexcept;
+        bool spin_acquire() noexcept;
+        MutexAcquire *dequeue() noexcept;
+        MutexAcquire *release() noexcept;
     };
 }
@@ -29,15 +29,41 @@
 namespace kls::coroutine {
     class SwitchTo {
     public:
-        explicit SwitchTo(IExecutor *next) noexcept: mNext(next) {}
+        explicit SwitchTo(IExecutor *next) noexcept: mNext(next), mDeadline(this_deadline()) {}
+
+        // switch and (re)assign the deadline the coroutine is scheduled with from now on
+        SwitchTo(IExecutor *next, Deadline deadline) noexcept: mNext(next), mDeadline(deadline) {}
+
+        // switch and run under tag from now on. the tag only carries over on executors that queue nodes
+        SwitchTo(IExecutor *next, const TaskTag &tag) noexcept: mNext(next), mDeadline(this_deadline()), mNode{.tag = &tag} {}
+
+        // a pointer to a concrete type that defines its own enqueue, such as a PolicyExecutor, is enqueued onto
+        // through that enqueue, which lets the whole hop inline
+        template<detail::TypedExecutor Exec>
+        explicit SwitchTo(Exec *next) noexcept: SwitchTo(static_cast<IExecutor *>(next)) { mPost = &detail::Post<Exec>; }
+
+        template<detail::TypedExecutor Exec>
+        SwitchTo(Exec *next, Deadline deadline) noexcept: SwitchTo(static_cast<IExecutor *>(next), deadline) {
+            mPost = &detail::Post<Exec>;
+        }
+
+        template<detail::TypedExecutor Exec>
+        SwitchTo(Exec *next, const TaskTag &tag) noexcept: SwitchTo(static_cast<IExecutor *>(next), tag) {
+            mPost = &detail::Post<Exec>;
+        }
 
         [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
 
-        void await_suspend(std::coroutine_handle<> handle) { mNext->enqueue(handle); }
+        void await_suspend(std::coroutine_handle<> handle) {
+            if (mPost) mPost(mNext, mNode, handle, mDeadline); else mNext->enqueue(mNode, handle, mDeadline);
+        }
 
         constexpr void await_resume() noexcept {}
     private:
         IExecutor *mNext;
+        detail::FnPost mPost{nullptr};
+        Deadline mDeadline;
+        TaskNode mNode{.tag = this_tag()};
     };
 
     struct Redispatch {
@@ -0,0 +1,326 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <ranges>
+#include <thread>
+#include <vector>
+#include <optional>
+#include "When.h"
+#include "Generator.h"
+#include "Operation.h"
+
+namespace kls::coroutine::detail {
+    // Shared bookkeeping of one parallel algorithm invocation. It lives in the frame of the calling
+    // coroutine, which stays suspended until every piece has joined.
+    class ParallelControl : public AddressSensitive {
+    public:
+        explicit ParallelControl(std::size_t grain) noexcept: m_exec(this_executor()), m_grain(grain ? grain : 1) {}
+
+        [[nodiscard]] IExecutor *executor() const noexcept { return m_exec; }
+
+        // Process [begin, end) by splitting off the upper half onto the executor until what remains is no
+        // larger than the grain, then run the body on the remainder in place. On a work stealing executor
+        // the halves land in the local queue of the current worker, idle workers steal the largest ones.
+        template<class Body>
+        void run(std::size_t begin, std::size_t end, Body &body);
+
+        void join() { if (m_pending.fetch_sub(1) == 1) m_trigger.pull(); }
+
+        bool trap(std::coroutine_handle<> h) {
+            if (m_pending.fetch_sub(1) == 1) return false;
+            return m_entry.set_handle(h), m_trigger.trap(m_entry);
+        }
+
+        // suspends the caller until all pieces have joined, and rethrows the first failure
+        auto join_all() noexcept {
+            struct Join {
+                ParallelControl &control;
+                [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+                bool await_suspend(std::coroutine_handle<> h) { return control.trap(h); }
+                void await_resume() const { if (control.m_error) std::rethrow_exception(control.m_error); }
+            };
+            return Join{*this};
+        }
+    private:
+        IExecutor *const m_exec;
+        const std::size_t m_grain;
+        std::atomic_size_t m_pending{1};
+        std::atomic_bool m_failed{false};
+        std::exception_ptr m_error{nullptr};
+        SingleExecutorTrigger m_trigger{};
+        ExecutorAwaitEntry m_entry{};
+
+        void fail() noexcept { if (!m_failed.exchange(true)) m_error = std::current_exception(); }
+    };
+
+    template<class Body>
+    WhenTask parallel_piece(ParallelControl &control, std::size_t begin, std::size_t end, Body &body) {
+        co_await SwitchTo(control.executor());
+        control.run(begin, end, body);
+        control.join();
+    }
+
+    template<class Body>
+    void ParallelControl::run(std::size_t begin, std::size_t end, Body &body) {
+        try {
+            while (m_exec && end - begin > m_grain) {
+                const auto mid = begin + (end - begin) / 2;
+                m_pending.fetch_add(1);
+                parallel_piece(*this, mid, end, body);
+                end = mid;
+            }
+            // once a piece has failed the result is lost anyway, skip the remaining work
+            if (!m_failed.load(std::memory_order_relaxed)) body(begin, end);
+        }
+        catch (...) {
+            fail();
+        }
+    }
+
+    inline std::size_t parallel_worker_index() noexcept {
+        static std::atomic_size_t next{0};
+        static thread_local const auto index = next.fetch_add(1);
+        return index;
+    }
+
+    // Partial results of a reduction, one slot per worker thread. Pieces fold their range locally and only
+    // touch the slot of the thread they ran on when they finish, so the slot locks are practically uncontended.
+    template<class T>
+    class ParallelPartials {
+        struct Slot {
+            thread::SpinLock lock{};
+            std::optional<T> value{};
+        };
+    public:
+        ParallelPartials(): m_count(std::max(1u, std::thread::hardware_concurrency())) {
+            m_slots = std::make_unique<Slot[]>(m_count);
+        }
+
+        template<class Op>
+        void merge(T &&v, Op &op) {
+            auto &slot = m_slots[parallel_worker_index() % m_count];
+            std::lock_guard lk{slot.lock};
+            if (slot.value) slot.value = op(std::move(*slot.value), std::move(v)); else slot.value.emplace(std::move(v));
+        }
+
+        template<class Op>
+        T collect(T init, Op &op) {
+            for (std::size_t i = 0; i < m_count; ++i) {
+                if (auto &v = m_slots[i].value; v) init = op(std::move(init), std::move(*v));
+            }
+            return init;
+        }
+    private:
+        const std::size_t m_count;
+        std::unique_ptr<Slot[]> m_slots{};
+    };
+
+    // The in-flight items of a parallel_map, one slot each. In order mode the slots form the reorder window
+    // and the result of the item with sequence number n goes to slot n % size. Otherwise slots are handed out
+    // from a free list and finished ones are queued in completion order. Only the generator side issues and
+    // takes, workers only complete.
+    template<class R>
+    class ParallelMapWindow : public AddressSensitive {
+        struct Slot {
+            ValueStore<R> value{};
+            std::exception_ptr error{};
+            bool ready{false};
+        };
+    public:
+        ParallelMapWindow(std::size_t size, bool ordered):
+                m_exec(this_executor()), m_size(size ? size : 1), m_ordered(ordered),
+                m_slots(std::make_unique<Slot[]>(m_size)) {
+            if (m_ordered) return;
+            m_free.reserve(m_size), m_done = std::make_unique<std::size_t[]>(m_size);
+            for (std::size_t i = m_size; i > 0; --i) m_free.push_back(i - 1);
+        }
+
+        [[nodiscard]] IExecutor *executor() const noexcept { return m_exec; }
+        [[nodiscard]] bool busy() const noexcept { return m_issued != m_taken; }
+        [[nodiscard]] bool has_room() const noexcept { return m_issued - m_taken < m_size; }
+
+        std::size_t issue() noexcept {
+            if (m_ordered) return m_issued++ % m_size;
+            const auto slot = m_free.back();
+            return m_free.pop_back(), ++m_issued, slot;
+        }
+
+        template<class Fn>
+        void complete(std::size_t slot, Fn &&fn) {
+            auto &target = m_slots[slot];
+            try { target.value.set(fn()); } catch (...) { target.error = std::current_exception(); }
+            ExecutorAwaitEntry *waiter = nullptr;
+            {
+                std::lock_guard lk{m_lock};
+                target.ready = true;
+                if (!m_ordered) m_done[(m_done_head + m_done_count++) % m_size] = slot;
+                if (ready_locked()) waiter = std::exchange(m_waiter, nullptr);
+            }
+            if (waiter) waiter->resume_async();
+        }
+
+        [[nodiscard]] bool ready() {
+            std::lock_guard lk{m_lock};
+            return ready_locked();
+        }
+
+        // suspends until the next result can be taken
+        auto completion() noexcept {
+            struct Await : AddressSensitive {
+                ParallelMapWindow &window;
+                ExecutorAwaitEntry entry{};
+                explicit Await(ParallelMapWindow &window) noexcept: window(window) {}
+                [[nodiscard]] bool await_ready() { return window.ready(); }
+                bool await_suspend(std::coroutine_handle<> h) {
+                    entry.set_handle(h);
+                    std::lock_guard lk{window.m_lock};
+                    if (window.ready_locked()) return false;
+                    return window.m_waiter = &entry, true;
+                }
+                constexpr void await_resume() const noexcept {}
+            };
+            return Await{*this};
+        }
+
+        // takes the next result, or returns the failure of its item
+        std::exception_ptr take(std::optional<R> &out) {
+            std::size_t slot;
+            {
+                std::lock_guard lk{m_lock};
+                if (m_ordered) slot = m_taken % m_size;
+                else slot = m_done[m_done_head], m_done_head = (m_done_head + 1) % m_size, --m_done_count;
+            }
+            auto &source = m_slots[slot];
+            auto error = std::exchange(source.error, nullptr);
+            if (!error) out.emplace(source.value.get());
+            source.value.reset();
+            {
+                std::lock_guard lk{m_lock};
+                source.ready = false, ++m_taken;
+            }
+            if (!m_ordered) m_free.push_back(slot);
+            return error;
+        }
+    private:
+        IExecutor *const m_exec;
+        const std::size_t m_size;
+        const bool m_ordered;
+        std::unique_ptr<Slot[]> m_slots;
+        std::vector<std::size_t> m_free{};
+        std::unique_ptr<std::size_t[]> m_done{};
+        std::size_t m_issued{0}, m_taken{0}, m_done_head{0}, m_done_count{0};
+        thread::SpinLock m_lock{};
+        ExecutorAwaitEntry *m_waiter{nullptr};
+
+        [[nodiscard]] bool ready_locked() const noexcept {
+            return m_ordered ? m_slots[m_taken % m_size].ready : m_done_count != 0;
+        }
+    };
+
+    template<class R, class T, class Fn>
+    WhenTask parallel_map_item(ParallelMapWindow<R> &window, std::size_t slot, T item, Fn &fn) {
+        if (window.executor()) co_await SwitchTo(window.executor());
+        window.complete(slot, [&]() { return fn(std::move(item)); });
+    }
+}
+
+namespace kls::coroutine {
+    // Invokes fn on every element of the range, spread over the executor the caller is running on.
+    // The calling coroutine works on its own share of the range and suspends once to join the rest.
+    // Without a current executor the range is processed sequentially in place.
+    template<std::ranges::random_access_range Range, class Fn>
+    ValueAsync<void> parallel_for(Range &&range, std::size_t grain, Fn fn) {
+        auto view = std::views::all(std::forward<Range>(range));
+        const auto first = std::ranges::begin(view);
+        auto body = [&](std::size_t begin, std::size_t end) { for (auto i = begin; i < end; ++i) fn(first[i]); };
+        detail::ParallelControl control{grain};
+        control.run(0, std::ranges::size(view), body);
+        co_await control.join_all();
+    }
+
+    // Writes fn(x) for every element x of the range to the sequence starting at out, in parallel.
+    template<std::ranges::random_access_range Range, std::random_access_iterator Out, class Fn>
+    ValueAsync<void> parallel_transform(Range &&range, Out out, std::size_t grain, Fn fn) {
+        auto view = std::views::all(std::forward<Range>(range));
+        const auto first = std::ranges::begin(view);
+        auto body = [&](std::size_t begin, std::size_t end) { for (auto i = begin; i < end; ++i) out[i] = fn(first[i]); };
+        detail::ParallelControl control{grain};
+        control.run(0, std::ranges::size(view), body);
+        co_await control.join_all();
+    }
+
+    // Reduces the range into init with op in parallel. Like std::reduce, op has to be associative and
+    // commutative, as the grouping and the order of the partial results is unspecified.
+    template<std::ranges::random_access_range Range, class T, class Op>
+    ValueAsync<T> parallel_reduce(Range &&range, T init, Op op, std::size_t grain = 1024) {
+        auto view = std::views::all(std::forward<Range>(range));
+        const auto first = std::ranges::begin(view);
+        detail::ParallelPartials<T> partials{};
+        auto body = [&](std::size_t begin, std::size_t end) {
+            T acc = static_cast<T>(first[begin]);
+            for (auto i = begin + 1; i < end; ++i) acc = op(std::move(acc), first[i]);
+            partials.merge(std::move(acc), op);
+        };
+        detail::ParallelControl control{grain};
+        if (const auto size = std::ranges::size(view); size) control.run(0, size, body);
+        co_await control.join_all();
+        co_return partials.collect(std::move(init), op);
+    }
+
+    // Maps the items of source with fn on the executor the generator runs on, keeping up to concurrency items
+    // in flight. Ordered results come out in source order, at most concurrency items behind the slowest one,
+    // otherwise in completion order. fn is invoked concurrently. Borrowed items are copied before being handed
+    // to the executor. A failure of the source or of fn is rethrown once all items in flight have finished.
+    template<class T, class Fn, class R = std::remove_cvref_t<std::invoke_result_t<Fn &, std::remove_cvref_t<T> &&>>>
+    AsyncGenerator<R> parallel_map(AsyncGenerator<T> source, Fn fn, std::size_t concurrency, bool ordered = true) {
+        static_assert(std::is_reference_v<T> || !enable_borrowed_yield<T>, "views cannot be held across items");
+        detail::ParallelMapWindow<R> window{concurrency, ordered};
+        std::exception_ptr error{nullptr};
+        std::optional<R> result{};
+        bool more = true;
+        for (;;) {
+            while (window.ready()) {
+                if (auto failure = window.take(result); failure) { if (!error) error = failure; continue; }
+                if (!error) co_yield std::move(*result);
+                result.reset();
+            }
+            if (more && !error && window.has_room()) {
+                try {
+                    if ((more = co_await source.forward())) {
+                        detail::parallel_map_item<R, std::remove_cvref_t<T>>(window, window.issue(), source.next(), fn);
+                    }
+                }
+                catch (...) { error = std::current_exception(), more = false; }
+                continue;
+            }
+            if (!window.busy()) break;
+            co_await window.completion();
+        }
+        // a source given up on after a failure of fn may still be running, it is let go once at its next yield
+        if (error && more) {
+            try { if (co_await source.forward()) detail::GeneratorAccess<T>::drop(source); } catch (...) {}
+        }
+        if (error) std::rethrow_exception(error);
+    }
+}
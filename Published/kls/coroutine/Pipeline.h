@@ -0,0 +1,530 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <tuple>
+#include <atomic>
+#include <mutex>
+#include <array>
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <utility>
+#include <concepts>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include "Generator.h"
+#include "kls/thread/SpinLock.h"
+
+namespace kls::coroutine::detail {
+    struct PipelineOp {};
+
+    // stages that neither hold items back nor end the stream early
+    struct PlainStage {
+        template<class Next>
+        constexpr bool flush(Next &&) const noexcept { return false; }
+        [[nodiscard]] constexpr bool exhausted() const noexcept { return false; }
+    };
+
+    template<class F>
+    struct MapOp : PipelineOp {
+        explicit MapOp(F fn) noexcept(std::is_nothrow_move_constructible_v<F>): fn(std::move(fn)) {}
+        F fn;
+
+        template<class In>
+        struct stage : PlainStage {
+            using output = std::remove_cvref_t<std::invoke_result_t<F &, In &&>>;
+            explicit stage(MapOp &&op): fn(std::move(op.fn)) {}
+            template<class Next>
+            bool push(In &&v, Next &&next) { return next(output(std::invoke(fn, std::move(v)))); }
+            F fn;
+        };
+    };
+
+    template<class P>
+    struct FilterOp : PipelineOp {
+        explicit FilterOp(P pred) noexcept(std::is_nothrow_move_constructible_v<P>): pred(std::move(pred)) {}
+        P pred;
+
+        template<class In>
+        struct stage : PlainStage {
+            using output = In;
+            explicit stage(FilterOp &&op): pred(std::move(op.pred)) {}
+            template<class Next>
+            bool push(In &&v, Next &&next) { return std::invoke(pred, std::as_const(v)) && next(std::move(v)); }
+            P pred;
+        };
+    };
+
+    struct TakeOp : PipelineOp {
+        explicit TakeOp(std::size_t count) noexcept: count(count) {}
+        std::size_t count;
+
+        template<class In>
+        struct stage {
+            using output = In;
+            explicit stage(TakeOp &&op) noexcept: left(op.count) {}
+            template<class Next>
+            bool push(In &&v, Next &&next) { return left != 0 && (--left, next(std::move(v))); }
+            template<class Next>
+            constexpr bool flush(Next &&) const noexcept { return false; }
+            [[nodiscard]] bool exhausted() const noexcept { return left == 0; }
+            std::size_t left;
+        };
+    };
+
+    struct ChunkOp : PipelineOp {
+        explicit ChunkOp(std::size_t size) noexcept: size(size) { assert(size > 0); }
+        std::size_t size;
+
+        template<class In>
+        struct stage {
+            static_assert(std::is_reference_v<In> || !enable_borrowed_yield<In>, "views cannot be held across items");
+            using output = std::vector<std::remove_cvref_t<In>>;
+            explicit stage(ChunkOp &&op): size(op.size) { buffer.reserve(size); }
+            template<class Next>
+            bool push(In &&v, Next &&next) {
+                buffer.push_back(std::move(v));
+                return buffer.size() == size && flush(next);
+            }
+            template<class Next>
+            bool flush(Next &&next) {
+                if (buffer.empty()) return false;
+                output full = std::exchange(buffer, {});
+                return buffer.reserve(size), next(std::move(full));
+            }
+            [[nodiscard]] constexpr bool exhausted() const noexcept { return false; }
+            std::size_t size;
+            output buffer{};
+        };
+    };
+
+    // The stages of a pipeline, flattened into one object. Items are pushed through all of them in a single call
+    // and only reach the output when every stage let them pass.
+    template<class In, class ...Ops>
+    class PipelineChain {
+    public:
+        using output = In;
+        template<class Out>
+        bool push(In &&v, Out &out) { return out.emit(std::move(v)); }
+        template<class Out>
+        constexpr bool flush(Out &) const noexcept { return false; }
+        [[nodiscard]] constexpr bool exhausted() const noexcept { return false; }
+    };
+
+    template<class In, class Op, class ...Rest>
+    class PipelineChain<In, Op, Rest...> {
+        using Stage = typename Op::template stage<In>;
+        using Next = PipelineChain<typename Stage::output, Rest...>;
+    public:
+        using output = typename Next::output;
+
+        explicit PipelineChain(Op &&op, Rest &&... rest): m_stage(std::move(op)), m_next(std::move(rest)...) {}
+
+        template<class Out>
+        bool push(In &&v, Out &out) { return m_stage.push(std::move(v), forward_to(out)); }
+
+        // releases whatever the stages still hold once the source has ended, one output per call
+        template<class Out>
+        bool flush(Out &out) { return (!m_next.exhausted() && m_stage.flush(forward_to(out))) || m_next.flush(out); }
+
+        [[nodiscard]] bool exhausted() const noexcept { return m_stage.exhausted() || m_next.exhausted(); }
+    private:
+        Stage m_stage;
+        Next m_next;
+
+        template<class Out>
+        auto forward_to(Out &out) { return [this, &out](typename Stage::output &&v) { return m_next.push(std::move(v), out); }; }
+    };
+
+    struct FirstHandOverTask {
+        struct promise_type {
+            constexpr FirstHandOverTask get_return_object() const noexcept { return {}; }
+            constexpr std::suspend_never initial_suspend() const noexcept { return {}; }
+            constexpr std::suspend_never final_suspend() const noexcept { return {}; }
+            constexpr void return_void() const noexcept {}
+            void unhandled_exception() const noexcept { std::terminate(); }
+        };
+    };
+
+    // traps the trigger of a source with an entry that resumes inline, wherever the source hands over
+    template<class T>
+    class FirstHandOverAwait : public AddressSensitive {
+    public:
+        explicit FirstHandOverAwait(typename AsyncGenerator<T>::promise_type &source) noexcept: m_source(source) {}
+        [[nodiscard]] constexpr bool await_ready() noexcept { return false; }
+        [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) { return m_e.set_handle(h), m_source.trap(m_e); }
+        constexpr void await_resume() const noexcept {}
+    private:
+        typename AsyncGenerator<T>::promise_type &m_source;
+        ExecutorAwaitEntry m_e{static_cast<IExecutor *>(nullptr)};
+    };
+
+    // calls 'then' once the eagerly started source, which may have yielded before anyone was listening, hands over
+    // for the first time. this is either right away or on the producer side while it is suspended, which is the
+    // only point a sink can be attached from
+    template<class T, class F>
+    FirstHandOverTask on_first_hand_over(typename AsyncGenerator<T>::promise_type &source, F then) {
+        co_await FirstHandOverAwait<T>(source);
+        then();
+    }
+
+    // a run is deleted by whichever of the consumer and its producers lets go of it last
+    struct AbandonRun {
+        template<class Run>
+        void operator()(Run *run) const noexcept { run->abandon(); }
+    };
+
+    // Runs the stages of a pipeline on the producer side. The first item is fed through the stages once the source
+    // hands it over, after which the run attaches itself as the sink of the source. From then on the source hands
+    // over to the run directly, so the consumer is only woken once an item made it through all stages, or the
+    // stream ended. The phase tells who owns the source frame: a running producer, which may reach the run again,
+    // or the consumer. The producer publishes it as the last thing it does to the run when handing over, so a
+    // consumer leaving in between is seen by the producer and it cleans up instead.
+    template<class T, class Chain>
+    class PipelineRun : public GeneratorSink<T>, public AddressSensitive {
+        using Promise = typename AsyncGenerator<T>::promise_type;
+        using Handle = std::coroutine_handle<Promise>;
+        using FnAccept = typename GeneratorSink<T>::FnAccept;
+        using FnHandOver = typename GeneratorSink<T>::FnHandOver;
+        enum Phase { Parked, Running, Waiting, Orphaned };
+    public:
+        using value_type = typename Chain::output;
+
+        PipelineRun(Promise &source, Chain &&chain):
+                GeneratorSink<T>(
+                        static_cast<FnAccept>(&PipelineRun::AcceptRawImpl),
+                        static_cast<FnHandOver>(&PipelineRun::HandOverRawImpl)
+                ),
+                m_source(source), m_chain(std::move(chain)) {}
+
+        bool wait(ExecutorAwaitEntry &consumer) {
+            if (m_has_out) release();
+            if (m_stopped) return false;
+            if (!m_started) {
+                m_started = true, m_phase.store(Running);
+                on_first_hand_over<T>(m_source, [this]() noexcept { first(); });
+            }
+            auto running = Running;
+            return m_waiter = &consumer, m_phase.compare_exchange_strong(running, Waiting);
+        }
+
+        bool resume() {
+            if (m_has_out) return true;
+            close();
+            return m_chain.flush(*this);
+        }
+
+        // a borrowed output is given back on the next wait, an owned one right away
+        value_type take() {
+            if constexpr (enable_borrowed_yield<value_type>) return m_out.get();
+            else {
+                value_type value = m_out.get();
+                release();
+                return value;
+            }
+        }
+
+        // the consumer lets go. a producer that is still running cleans up at its next hand over instead
+        void abandon() noexcept {
+            if (m_started) {
+                if (auto running = Running; m_phase.compare_exchange_strong(running, Orphaned)) return;
+                if (!m_closed) Handle::from_promise(m_source).destroy();
+            }
+            delete this;
+        }
+
+        bool emit(value_type &&v) { return m_out.set(std::move(v)), m_has_out = true; }
+    private:
+        Promise &m_source;
+        Chain m_chain;
+        ValueStore<value_type> m_out{};
+        std::exception_ptr m_fail{};
+        std::atomic<Phase> m_phase{Parked};
+        ExecutorAwaitEntry *m_waiter{nullptr};
+        bool m_has_out{false}, m_started{false}, m_done{false}, m_stopped{false}, m_closed{false};
+
+        void release() {
+            m_out.reset(), m_has_out = false;
+            if (m_done || m_fail || m_chain.exhausted()) m_stopped = true; else m_phase.store(Running), m_source.resume();
+        }
+
+        void close() {
+            if (std::exchange(m_closed, true)) return;
+            m_stopped = true;
+            const auto handle = Handle::from_promise(m_source);
+            essential::Final final{[handle]() { handle.destroy(); }};
+            if (m_fail) std::rethrow_exception(m_fail);
+            if (m_done) m_source.final();
+        }
+
+        // the source handed over for the first time, with either its first item which has not seen the stages
+        // yet, or its end
+        void first() noexcept {
+            if (!Handle::from_promise(m_source).done()) {
+                m_source.attach(this);
+                try {
+                    if (!AcceptRawImpl(m_source.get_value())) return m_source.reset(), m_source.resume();
+                }
+                catch (...) { m_fail = std::current_exception(); }
+            }
+            HandOverRawImpl();
+        }
+
+        bool AcceptRawImpl(T &&item) { return m_chain.push(std::move(item), *this) || m_chain.exhausted(); }
+
+        // the source has suspended: either the stream ended, or an item made it through the stages
+        void HandOverRawImpl() noexcept {
+            if (Handle::from_promise(m_source).done()) m_done = true;
+            switch (m_phase.exchange(Parked)) {
+                case Waiting: return m_waiter->resume_async();
+                case Orphaned: return Handle::from_promise(m_source).destroy(), delete this;
+                default: return;
+            }
+        }
+    };
+
+    // Interleaves the items of several sources in the order they are yielded. The run attaches a slot as the sink
+    // of every source, which holds its item and queues the index of the source to wake the consumer. A source that
+    // ended is only reported once it is the last one, or if it failed. A source left running by a consumer that
+    // let go destroys itself at its next hand over, and the last one to do so deletes the run.
+    template<class T, std::size_t N>
+    class MergeRun : public AddressSensitive {
+        using Promise = typename AsyncGenerator<T>::promise_type;
+        using Handle = std::coroutine_handle<Promise>;
+        enum State { Live, Parked, Gone };
+
+        class Slot : public GeneratorSink<T> {
+            using FnAccept = typename GeneratorSink<T>::FnAccept;
+            using FnHandOver = typename GeneratorSink<T>::FnHandOver;
+        public:
+            Slot() noexcept: GeneratorSink<T>(
+                    static_cast<FnAccept>(&Slot::AcceptRawImpl),
+                    static_cast<FnHandOver>(&Slot::HandOverRawImpl)
+            ) {}
+
+            MergeRun *run{nullptr};
+            std::size_t index{0};
+            ValueStore<T> item{};
+        private:
+            bool AcceptRawImpl(T &&v) { return item.set(std::forward<T>(v)), true; }
+            void HandOverRawImpl() noexcept { run->post(index); }
+        };
+    public:
+        template<class ...G>
+        explicit MergeRun(G... sources): m_sources{GeneratorAccess<T>::promise(sources)...} {
+            m_state.fill(Live);
+            for (std::size_t i = 0; i < N; ++i) m_slots[i].run = this, m_slots[i].index = i;
+            for (std::size_t i = 0; i < N; ++i) on_first_hand_over<T>(*m_sources[i], [this, i]() noexcept { first(i); });
+        }
+
+        bool wait(ExecutorAwaitEntry &consumer) {
+            if (std::exchange(m_held, false)) release(m_current);
+            if (m_closed) return false;
+            std::lock_guard lk{m_lock};
+            if (m_count) return false;
+            return m_waiter = &consumer, true;
+        }
+
+        bool resume() {
+            {
+                std::lock_guard lk{m_lock};
+                if (m_closed) return false;
+                m_current = m_ring[m_head], m_head = (m_head + 1) % N, --m_count;
+            }
+            if (!Handle::from_promise(*m_sources[m_current]).done()) return true;
+            m_closed = true;
+            {
+                std::lock_guard lk{m_lock};
+                for (std::size_t i = 0; i < N; ++i) {
+                    const auto h = Handle::from_promise(*m_sources[i]);
+                    if (m_state[i] == Parked && h.done()) h.destroy(), m_state[i] = Gone;
+                }
+            }
+            if (m_fail) std::rethrow_exception(m_fail);
+            return false;
+        }
+
+        T take() {
+            if constexpr (enable_borrowed_yield<T>) {
+                m_held = true;
+                return m_slots[m_current].item.get();
+            }
+            else {
+                T value = m_slots[m_current].item.get();
+                release(m_current);
+                return value;
+            }
+        }
+
+        // the consumer lets go. sources that are still running clean up at their next hand over instead
+        void abandon() noexcept {
+            bool last;
+            {
+                std::lock_guard lk{m_lock};
+                m_orphaned = true;
+                for (std::size_t i = 0; i < N; ++i) {
+                    if (m_state[i] == Parked) Handle::from_promise(*m_sources[i]).destroy(), m_state[i] = Gone;
+                }
+                last = m_live == 0;
+            }
+            if (last) delete this;
+        }
+    private:
+        std::array<Promise *, N> m_sources;
+        std::array<Slot, N> m_slots{};
+        std::array<State, N> m_state{};
+        thread::SpinLock m_lock{};
+        std::array<std::size_t, N> m_ring{};
+        std::size_t m_head{0}, m_count{0}, m_finished{0}, m_current{0}, m_live{N};
+        ExecutorAwaitEntry *m_waiter{nullptr};
+        std::exception_ptr m_fail{};
+        bool m_held{false}, m_closed{false}, m_orphaned{false};
+
+        void release(std::size_t index) {
+            m_slots[index].item.reset();
+            {
+                std::lock_guard lk{m_lock};
+                m_state[index] = Live, ++m_live;
+            }
+            m_sources[index]->resume();
+        }
+
+        // the source handed over for the first time, with either its first item or its end
+        void first(std::size_t index) noexcept {
+            auto &source = *m_sources[index];
+            if (!Handle::from_promise(source).done()) {
+                source.attach(&m_slots[index]);
+                m_slots[index].item.set(source.get_value());
+                source.reset();
+            }
+            post(index);
+        }
+
+        void post(std::size_t index) noexcept {
+            ExecutorAwaitEntry *waiter{nullptr};
+            bool last{false};
+            {
+                std::lock_guard lk{m_lock};
+                --m_live;
+                if (m_orphaned) {
+                    Handle::from_promise(*m_sources[index]).destroy(), m_state[index] = Gone;
+                    last = m_live == 0;
+                }
+                else {
+                    m_state[index] = Parked;
+                    if (Handle::from_promise(*m_sources[index]).done()) {
+                        try { m_sources[index]->final(); }
+                        catch (...) { if (!m_fail) m_fail = std::current_exception(); }
+                        if (++m_finished < N && !m_fail) return;
+                    }
+                    m_ring[(m_head + m_count++) % N] = index;
+                    waiter = std::exchange(m_waiter, nullptr);
+                }
+            }
+            if (last) delete this; else if (waiter) waiter->resume_async();
+        }
+    };
+
+    template<class Run>
+    class PipelineAwait : public AddressSensitive {
+    public:
+        explicit PipelineAwait(Run &run) noexcept: m_run(run) {}
+        [[nodiscard]] constexpr bool await_ready() noexcept { return false; }
+        [[nodiscard]] bool await_suspend(std::coroutine_handle<> h) { return m_e.set_handle(h), m_run.wait(m_e); }
+        [[nodiscard]] bool await_resume() { return m_run.resume(); }
+    private:
+        Run &m_run;
+        coroutine::ExecutorAwaitEntry m_e;
+    };
+}
+
+namespace kls::coroutine {
+    // An AsyncGenerator with a chain of stages fused into its producer. Built with operator| and consumed with
+    // the same forward()/next() protocol as the generator itself. Items rejected by a stage never leave the
+    // producer, so the per item cost is that of the plain generator no matter how many stages are chained.
+    template<class T, class ...Ops>
+    class Pipeline {
+        using Chain = detail::PipelineChain<T, Ops...>;
+        using Run = detail::PipelineRun<T, Chain>;
+    public:
+        using value_type = typename Chain::output;
+
+        Pipeline(AsyncGenerator<T> source, std::tuple<Ops...> ops): m_source(source), m_ops(std::move(ops)) {}
+        Pipeline(Pipeline &&) noexcept = default;
+
+        [[nodiscard]] auto forward() {
+            if (!m_run) {
+                auto &source = *detail::GeneratorAccess<T>::promise(m_source);
+                m_run.reset(new Run(source, std::make_from_tuple<Chain>(std::move(m_ops))));
+            }
+            return detail::PipelineAwait<Run>(*m_run);
+        }
+
+        [[nodiscard]] value_type next() { return m_run->take(); }
+
+        template<std::derived_from<detail::PipelineOp> Op>
+        friend Pipeline<T, Ops..., Op> operator|(Pipeline &&pipeline, Op op) {
+            assert(!pipeline.m_run);
+            return {pipeline.m_source, std::tuple_cat(std::move(pipeline.m_ops), std::make_tuple(std::move(op)))};
+        }
+    private:
+        AsyncGenerator<T> m_source;
+        std::tuple<Ops...> m_ops;
+        std::unique_ptr<Run, detail::AbandonRun> m_run{};
+    };
+
+    template<class T, std::derived_from<detail::PipelineOp> Op>
+    Pipeline<T, Op> operator|(AsyncGenerator<T> source, Op op) { return {source, std::make_tuple(std::move(op))}; }
+
+    template<class T, std::size_t N>
+    class MergedGenerator {
+        using Run = detail::MergeRun<T, N>;
+    public:
+        template<class ...G>
+        explicit MergedGenerator(G... sources): m_run(new Run(sources...)) {}
+        MergedGenerator(MergedGenerator &&) noexcept = default;
+
+        [[nodiscard]] auto forward() noexcept { return detail::PipelineAwait<Run>(*m_run); }
+        [[nodiscard]] T next() { return m_run->take(); }
+    private:
+        std::unique_ptr<Run, detail::AbandonRun> m_run;
+    };
+
+    template<class F>
+    auto map(F fn) { return detail::MapOp<F>(std::move(fn)); }
+
+    template<class P>
+    auto filter(P pred) { return detail::FilterOp<P>(std::move(pred)); }
+
+    inline auto take(std::size_t count) noexcept { return detail::TakeOp(count); }
+
+    inline auto chunk(std::size_t size) noexcept { return detail::ChunkOp(size); }
+
+    template<class T, class ...G>
+    requires (std::same_as<G, AsyncGenerator<T>> && ...)
+    MergedGenerator<T, 1 + sizeof...(G)> merge(AsyncGenerator<T> first, G... rest) {
+        return MergedGenerator<T, 1 + sizeof...(G)>(first, rest...);
+    }
+}
@@ -0,0 +1,472 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <algorithm>
+#include "Scaling.h"
+#include "Operation.h"
+#include "detail/Spin.h"
+#include "detail/CacheLine.h"
+#include "detail/FifoQueue.h"
+#include "detail/Worker.h"
+#include "detail/QueueDrain.h"
+#include "kls/thread/SpinLock.h"
+#include "kls/thread/Semaphore.h"
+
+namespace kls::coroutine {
+    // idle policy: a worker that finds the queue empty parks right away
+    struct ParkIdle {
+        template<class Ready>
+        static bool idle(Ready &&) noexcept { return false; }
+    };
+
+    // idle policy: a worker polls the queue for up to Microseconds before parking. spinning threads count as busy
+    template<std::int64_t Microseconds>
+    struct SpinIdle {
+        template<class Ready>
+        static bool idle(Ready &&ready) noexcept {
+            return detail::SpinFor(std::chrono::microseconds(Microseconds), std::forward<Ready>(ready));
+        }
+    };
+
+    // scaling policy: threads come and go as the IScalingPolicy decides within the limits. one enqueue in
+    // ProbeEvery per thread, and every enqueue while no thread is parked, is timed through the queue, and a worker
+    // that has run CheckEvery tasks in a row with no thread parked asks for a decision, as a backlog queued in one
+    // burst carries a single probe. a probe left queued for StallMicroseconds with no thread parked gets a thread
+    // up to max without asking, once per that span, as the running threads may all be waiting on it
+    template<std::uint32_t ProbeEvery = 64, std::uint32_t CheckEvery = 16, std::int64_t StallMicroseconds = 10'000>
+    struct AdaptiveScaling {
+        static constexpr bool Adaptive = true;
+        static constexpr std::uint32_t Probe = ProbeEvery, Check = CheckEvery;
+        static constexpr auto Stall = std::chrono::microseconds(StallMicroseconds);
+    };
+
+    // scaling policy: the pool holds the lower limit and only grows to stand in for blocking sections. nothing is
+    // sampled and parked threads never time out
+    struct FixedScaling {
+        static constexpr bool Adaptive = false;
+    };
+
+    // a pool of threads draining one queue, header-only so that a coroutine switching to it through a typed
+    // SwitchTo has the whole enqueue inlined. the scaling executors of this library are instances of it.
+    // Queue<void *> needs Add, Get, SnapshotNotEmpty, Finalize and Detach as detail::FifoQueue has them, while
+    // Link, Get(detail::TaskTrace &) and a ByDeadline constant are optional. the rest of detail is not API
+    template<
+            template<class> class Queue = detail::FifoQueue,
+            class Idle = ParkIdle,
+            class Scale = AdaptiveScaling<>
+    >
+    class PolicyExecutor final : public IExecutor, public detail::IHelpable, public ScalingControl {
+        using Clock = std::chrono::steady_clock;
+        using Reason = ScalingSample::Reason;
+        static constexpr bool Linkable = requires(Queue<void *> &q, TaskNode *n) { q.Link(n); };
+        static constexpr bool ByDeadline = requires { Queue<void *>::ByDeadline; };
+        // shortest span utilization is measured over, also the least time between two growth decisions
+        static constexpr std::int64_t Window = 1'000'000;
+    public:
+        // any trailing arguments are forwarded to the queue. an adaptive pool without a policy gets the default one
+        template<class ...U>
+        explicit PolicyExecutor(ScalingLimits limits, std::shared_ptr<IScalingPolicy> policy = {}, U &&... queue) :
+                IExecutor(static_cast<FnEnqueue>(&PolicyExecutor::EnqueueRawImpl), NodePath(), ByDeadline),
+                IHelpable(
+                        static_cast<FnHelpOnce>(&PolicyExecutor::HelpOnceImpl),
+                        static_cast<FnBlocking>(&PolicyExecutor::BlockingImpl),
+                        static_cast<FnPark>(&PolicyExecutor::ParkImpl)
+                ),
+                ScalingControl(this, limits), mPolicy(DefaultPolicy(std::move(policy))),
+                mDrainer(std::forward<U>(queue)...) {
+            mSampledAt = Ticks(Clock::now());
+            Fill();
+            if constexpr (Scale::Adaptive) mWatchdog = std::thread([this]() noexcept { Watch(); });
+        }
+
+        ~PolicyExecutor() {
+            Shutdown();
+            mFinal.wait();
+            if (mWatchdog.joinable()) {
+                mWatchSignal.signal();
+                mWatchdog.join();
+            }
+        }
+
+        using IExecutor::enqueue;
+
+        void enqueue(std::coroutine_handle<> handle) noexcept { Add(handle.address()); }
+
+        // the node path without going through IExecutor, picked by awaiters that know the executor type. a queue
+        // ordering by deadline reads it from the enqueuing thread, which IExecutor swaps in for the call
+        void enqueue(TaskNode &node, std::coroutine_handle<> handle, Deadline deadline) noexcept {
+            if constexpr (Linkable && !ByDeadline) {
+                node.next = nullptr, node.handle = handle.address(), node.queued = detail::QueueStamp();
+                EnqueueNodeImpl(&node);
+            } else IExecutor::enqueue(node, handle, deadline);
+        }
+
+    private:
+        // read-mostly state shares a line. the park counter is touched on every enqueue, the semaphores by
+        // parking threads, the probe by sampled enqueues, the idle account on every park, the decision state
+        // by workers asking for a decision and the watchdog flag on every saturated enqueue, so each of them
+        // gets its own
+        std::atomic_bool mRun{true};
+        const std::shared_ptr<IScalingPolicy> mPolicy;
+        alignas(detail::CacheLine) std::atomic_int mPark{0};
+        alignas(detail::CacheLine) thread::Semaphore mSignal{};
+        thread::Semaphore mFinal{};
+        // the probe is a single queued task being timed. 'this' marks it as being armed
+        alignas(detail::CacheLine) std::atomic<void *> mProbe{nullptr};
+        std::atomic<std::int64_t> mProbeAt{0}, mWait{0};
+        alignas(detail::CacheLine) thread::SpinLock mIdleLock{};
+        std::int64_t mIdle{0}, mParked{0}, mParkedSince{0};
+        // threads inside a blocking section are alive but not counted against the limits
+        alignas(detail::CacheLine) std::atomic_int mBlocked{0};
+        // threads helping from inside run_blocking that found nothing to run, woken along with parked workers
+        alignas(detail::CacheLine) std::atomic_int mHelping{0};
+        thread::SpinLock mHelperLock{};
+        detail::HelperPark *mHelpers{nullptr};
+        alignas(detail::CacheLine) std::atomic<std::int64_t> mNextEval{0};
+        std::mutex mDecide{};
+        std::int64_t mSampledAt{0}, mSampledIdle{0};
+        double mUtilization{0.0};
+        // set while the watchdog keeps an eye on the probe, so that only the enqueue that sets it wakes the watchdog
+        alignas(detail::CacheLine) std::atomic_bool mWatching{false};
+        thread::Semaphore mWatchSignal{};
+        std::thread mWatchdog{};
+        alignas(detail::CacheLine) detail::QueueDrain<Queue, void *> mDrainer;
+
+        static std::shared_ptr<IScalingPolicy> DefaultPolicy(std::shared_ptr<IScalingPolicy> policy) {
+            if (!policy && Scale::Adaptive) policy = std::make_shared<AdaptiveScalingPolicy>();
+            return policy;
+        }
+
+        static std::int64_t Ticks(Clock::time_point t) noexcept {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+        }
+
+        void EnqueueRawImpl(void *handle) noexcept { Add(handle); }
+
+        void EnqueueNodeImpl(TaskNode *node) noexcept {
+            ArmProbe(node->handle);
+            mDrainer.Link(node);
+            Notify();
+        }
+
+        // queues that cannot link a node leave the executor on the plain path
+        static constexpr FnEnqueueNode NodePath() noexcept {
+            if constexpr (Linkable) return static_cast<FnEnqueueNode>(&PolicyExecutor::EnqueueNodeImpl);
+            else return nullptr;
+        }
+
+        bool HelpOnceImpl() noexcept { return mDrainer.RunOne([this](void *task) noexcept { CheckProbe(task); }); }
+
+        void BlockingImpl(bool enter) noexcept {
+            if (enter) {
+                mBlocked.fetch_add(1);
+                // queued work would otherwise wait for this thread. Rest has no fence pairing with this check,
+                // but a task missed here is picked up on the next enqueue or linger timeout
+                if (mDrainer.ShouldActive() && !TryWake()) Grow(Reason::Blocking);
+            } else {
+                // the surplus is a parked thread most of the time, wake one so that it retires right away
+                if (Active(mBlocked.fetch_sub(1) - 1) > mMax.load(std::memory_order_relaxed)) TryWake();
+            }
+        }
+
+        bool ParkImpl(detail::HelperPark &park, bool enter) noexcept {
+            {
+                std::lock_guard lk{mHelperLock};
+                if (enter) park.next = std::exchange(mHelpers, &park);
+                else {
+                    for (auto p = &mHelpers; *p; p = &(*p)->next) {
+                        if (*p == &park) {
+                            *p = park.next;
+                            break;
+                        }
+                    }
+                }
+            }
+            mHelping.fetch_add(enter ? 1 : -1);
+            // pairs with the fence in Notify, so either this sees the task or the enqueue sees the park
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return mDrainer.ShouldActive();
+        }
+
+        bool WakeHelper() noexcept {
+            if (!mHelping.load(std::memory_order_relaxed)) return false;
+            std::lock_guard lk{mHelperLock};
+            for (auto p = mHelpers; p; p = p->next) if (p->wake()) return true;
+            return false;
+        }
+
+        [[nodiscard]] int Active(int blocked) const noexcept { return mTotal.load() - blocked; }
+
+        ValueAsync<void> Shutdown() {
+            co_await SwitchTo{this};
+            // notify the underlying queue to join all non-executor que
+            mDrainer.Finalize();
+            // tell the executors that they should join after finishing whatever they are doing
+            mRun = false;
+            // wake all parked executors
+            while (TryWake());
+        }
+
+        void Add(void *task) {
+            ArmProbe(task);
+            mDrainer.Add(task);
+            Notify();
+        }
+
+        bool TryWake() {
+            for (;;) {
+                // try to awake an existing thread
+                if (auto c = mPark.load(); c) {
+                    if (mPark.compare_exchange_strong(c, c - 1)) return (mSignal.signal(), true);
+                } else return false;
+            }
+        }
+
+        void Notify() {
+            // pairs with the fence in Rest, so either this sees the parking thread or it sees the task
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // a thread spawned to fill up to min picks the task up as well
+            if (Active(mBlocked.load()) < std::max(mMin.load(std::memory_order_relaxed), 1) && Fill()) return;
+            if (TryWake() || WakeHelper()) return;
+            // no thread is free to take the task. the policy decides on growing, the watchdog steps in if the task
+            // is left queued all the same
+            if constexpr (Scale::Adaptive) {
+                if (!mWatching.load(std::memory_order_relaxed) && !mWatching.exchange(true)) mWatchSignal.signal();
+            }
+            Evaluate(Reason::Saturated);
+        }
+
+        void ArmProbe(void *task) noexcept {
+            if constexpr (Scale::Adaptive) {
+                static thread_local std::uint32_t count = 0;
+                // a task queued while no thread is parked is always timed, for the watchdog to see it stall
+                if (count++ % Scale::Probe && mPark.load(std::memory_order_relaxed)) return;
+                if (mProbe.load(std::memory_order_relaxed)) return;
+                if (void *expect = nullptr; mProbe.compare_exchange_strong(expect, this, std::memory_order_relaxed)) {
+                    mProbeAt.store(Ticks(Clock::now()), std::memory_order_relaxed);
+                    mProbe.store(task, std::memory_order_release);
+                }
+            }
+        }
+
+        void CheckProbe(void *task) noexcept {
+            if (!Scale::Adaptive || mProbe.load(std::memory_order_acquire) != task) return;
+            const auto wait = Ticks(Clock::now()) - mProbeAt.load(std::memory_order_relaxed);
+            mProbe.store(nullptr, std::memory_order_relaxed);
+            const auto last = mWait.load(std::memory_order_relaxed);
+            mWait.store(last + (wait - last) / 4, std::memory_order_relaxed);
+            Evaluate(Reason::SlowQueue);
+        }
+
+        // must be called with mDecide held
+        ScalingSample Sample(Reason reason, Clock::time_point now) noexcept {
+            const auto at = Ticks(now);
+            const auto threads = mTotal.load();
+            const auto idle = [&]() noexcept {
+                std::lock_guard lk{mIdleLock};
+                // threads parked right now count as idle up to this point
+                return mIdle + mParked * at - mParkedSince;
+            }();
+            if (const auto elapsed = at - mSampledAt; elapsed >= Window) {
+                const auto capacity = double(elapsed) * std::max(threads, 1);
+                const auto busy = std::clamp(1.0 - double(idle - mSampledIdle) / capacity, 0.0, 1.0);
+                mUtilization = (mUtilization + busy) / 2;
+                mSampledAt = at;
+                mSampledIdle = idle;
+            }
+            auto wait = mWait.load(std::memory_order_relaxed);
+            // a probe that is still queued has been waiting for at least this long
+            if (const auto probe = mProbe.load(std::memory_order_acquire); probe && probe != this) {
+                wait = std::max(wait, at - mProbeAt.load(std::memory_order_relaxed));
+            }
+            return {
+                    reason, threads, mPark.load(), mBlocked.load(), limits(),
+                    std::chrono::nanoseconds(wait), mUtilization, now
+            };
+        }
+
+        // spawns up to min threads, and one if there is none at all so that queued work always runs. returns
+        // whether it spawned any
+        bool Fill() {
+            std::lock_guard lk{mDecide};
+            if (!mRun) return false;
+            const auto target = std::max(mMin.load(std::memory_order_relaxed), 1) + mBlocked.load();
+            bool spawned = false;
+            for (auto c = mTotal.load(); c < target; c = mTotal.load()) {
+                if (mTotal.compare_exchange_strong(c, c + 1)) {
+                    Spawned(c + 1, Sample(Reason::Saturated, Clock::now()));
+                    spawned = true;
+                }
+            }
+            return spawned;
+        }
+
+        void Evaluate(Reason reason) {
+            if (!Scale::Adaptive) return;
+            const auto now = Clock::now();
+            if (Ticks(now) < mNextEval.load(std::memory_order_relaxed)) return;
+            std::unique_lock lk{mDecide, std::try_to_lock};
+            if (!lk || !mRun) return;
+            mNextEval.store(Ticks(now) + Window, std::memory_order_relaxed);
+            const auto sample = Sample(reason, now);
+            auto c = sample.threads;
+            if (c - sample.blocked >= sample.limits.max || mPolicy->decide(sample) != ScalingDecision::Spawn) return;
+            if (mTotal.compare_exchange_strong(c, c + 1)) Spawned(c + 1, sample);
+        }
+
+        // the watchdog. it sleeps until a saturated enqueue wakes it, then looks at the probe once every Stall for
+        // as long as one is queued
+        void Watch() noexcept {
+            for (;;) {
+                mWatchSignal.wait();
+                for (;;) {
+                    // only the destructor signals a watchdog that is on watch
+                    if (!mRun || mWatchSignal.wait_for(Scale::Stall) || !mRun) return;
+                    const auto probe = mProbe.load(std::memory_order_acquire);
+                    if (!probe) {
+                        // an enqueue arming a probe right now either sees the flag cleared or is seen here
+                        mWatching.store(false);
+                        if (!mProbe.load() || mWatching.exchange(true)) break;
+                        continue;
+                    }
+                    if (probe == this || mPark.load()) continue;
+                    const auto age = Ticks(Clock::now()) - mProbeAt.load(std::memory_order_relaxed);
+                    if (age >= std::chrono::nanoseconds(Scale::Stall).count()) Grow(Reason::Stalled);
+                }
+            }
+        }
+
+        // spawns one thread unless that crosses max, for queued work no running thread is free to pick up
+        void Grow(Reason reason) {
+            if (Active(mBlocked.load()) >= mMax.load(std::memory_order_relaxed)) return;
+            std::lock_guard lk{mDecide};
+            if (!mRun) return;
+            const auto sample = Sample(reason, Clock::now());
+            auto c = sample.threads;
+            if (c - sample.blocked >= sample.limits.max) return;
+            if (mTotal.compare_exchange_strong(c, c + 1)) Spawned(c + 1, sample);
+        }
+
+        // the count has been raised to threads already
+        void Spawned(int threads, const ScalingSample &sample) {
+            Spawn();
+            if (mPolicy) mPolicy->record({ScalingDecision::Spawn, threads, sample});
+        }
+
+        void Spawn() {
+            std::thread([this]() noexcept {
+                detail::SetCurrentExecutor(this);
+                detail::SetCurrentHelpable(this);
+                for (std::uint32_t ran = 0;;) {
+                    mDrainer.Drain([this, &ran](void *task) noexcept {
+                        CheckProbe(task);
+                        if constexpr (Scale::Adaptive) {
+                            if (++ran % Scale::Check == 0 && !mPark.load(std::memory_order_relaxed)) {
+                                Evaluate(Reason::Saturated);
+                            }
+                        }
+                    });
+                    if (!mRun) break;
+                    if (Idle::idle([this]() noexcept { return mDrainer.ShouldActive() || !mRun; })) continue;
+                    if (!Rest()) return; // retired, the count is already dropped
+                }
+                // the executor has been commanded to stop. as stop is set by the last added task,
+                // all tasks added before should be already drained.
+                Leave(std::unique_lock{mDecide});
+            }).detach();
+        }
+
+        // drops this thread from the count. it happens under the decision lock, so a spawn decided concurrently
+        // either sees the stop or is counted before the last thread leaves
+        void Leave(std::unique_lock<std::mutex> lk) noexcept {
+            mDrainer.Detach(); // before the count drops, as the executor may be gone right after
+            const auto last = mTotal.fetch_sub(1) == 1 && !mRun;
+            lk.unlock();
+            if (last) mFinal.signal(); // this is the last thread. notify final
+        }
+
+        // returns false when the thread has retired
+        bool Rest() noexcept {
+            // a thread left over from compensating a blocking section that has ended retires without lingering
+            if (Active(mBlocked.load()) > mMax.load(std::memory_order_relaxed) && TryRetire(Reason::Blocking)) {
+                return false;
+            }
+            mPark.fetch_add(1); // enter protected region
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (mDrainer.ShouldActive() || !mRun) {
+                // it is possible that a task was added during function invocation period of this function and the WakeOne
+                // did not notice this thread is going to sleep. To prevent system stalling, we will unconditionally
+                // signal to wake a worker (including this one)
+                TryWake();
+            }
+            // to keep integrity, this thread will enter sleep state regardless of whether if the snapshot check is positive
+            if (!Scale::Adaptive) return (mSignal.wait(), true);
+            const auto from = Ticks(Clock::now());
+            Parking(from, 1);
+            const auto linger = std::chrono::milliseconds(mLinger.load(std::memory_order_relaxed));
+            const auto result = mSignal.wait_for(linger);
+            const auto to = Ticks(Clock::now());
+            Parking(from, -1);
+            {
+                std::lock_guard lk{mIdleLock};
+                mIdle += to - from;
+            }
+            if (result) return true;
+            // timed out. take the park count back, unless wakers have claimed all of it and a signal is on its way
+            for (auto c = mPark.load();;) {
+                if (!c) return (mSignal.wait(), true);
+                if (mPark.compare_exchange_weak(c, c - 1)) break;
+            }
+            return !TryRetire(Reason::Idle);
+        }
+
+        void Parking(std::int64_t from, int delta) noexcept {
+            std::lock_guard lk{mIdleLock};
+            mParked += delta;
+            mParkedSince += from * delta;
+        }
+
+        // called by a thread that stayed parked for the whole linger period, or is surplus to a blocking section
+        bool TryRetire(Reason reason) noexcept {
+            std::unique_lock lk{mDecide};
+            if (!mRun) return false;
+            // nothing was queued while this thread lingered, so the smoothed wait decays
+            if (reason == Reason::Idle) mWait.store(mWait.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+            const auto sample = Sample(reason, Clock::now());
+            const auto c = sample.threads, active = c - sample.blocked;
+            if (active <= sample.limits.min) return false;
+            if (active <= sample.limits.max) {
+                if (reason != Reason::Idle || mPolicy->decide(sample) != ScalingDecision::Retire) return false;
+            }
+            if (mPolicy) mPolicy->record({ScalingDecision::Retire, c - 1, sample});
+            Leave(std::move(lk));
+            return true;
+        }
+    };
+}
@@ -0,0 +1,73 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <source_location>
+#include "Executor.h"
+
+namespace kls::coroutine {
+    namespace detail { struct TagAccess; }
+
+    // a label tasks are profiled under. a tag is listed in reports from construction until it is destroyed, and
+    // has to outlive every task running under it, which static tags do. a task carries its tag through FIFO queues, work dequeued from the bag and
+    // deadline queues or passed between shards runs untagged
+    class TaskTag : public AddressSensitive {
+    public:
+        explicit TaskTag(const char *name, std::source_location where = std::source_location::current()) noexcept;
+
+        ~TaskTag() noexcept;
+
+        [[nodiscard]] const char *name() const noexcept { return mName; }
+
+        [[nodiscard]] const std::source_location &where() const noexcept { return mWhere; }
+    private:
+        friend struct detail::TagAccess;
+        const char *mName;
+        std::source_location mWhere;
+        mutable const TaskTag *mNext{nullptr};
+        mutable std::atomic<std::uint64_t> mResumes{0};
+        mutable std::atomic<std::int64_t> mCpu{0}, mWait{0};
+    };
+
+    // totals of one tag. cpu is the thread cpu time of the runs, including tasks they resumed inline, and wait
+    // the time spent queued before them
+    struct TaskProfile {
+        const TaskTag *tag; // nullptr for work that ran under no tag
+        std::uint64_t resumes;
+        std::chrono::nanoseconds cpu, wait;
+    };
+
+    // profiling is off until enabled. with it off the drain loops only keep track of the running tag
+    void set_profiling(bool enabled) noexcept;
+
+    [[nodiscard]] bool profiling() noexcept;
+
+    // every tag that has run since the last reset, the most cpu first
+    [[nodiscard]] std::vector<TaskProfile> profile_report();
+
+    void reset_profile() noexcept;
+}
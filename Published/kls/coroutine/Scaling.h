@@ -0,0 +1,163 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <functional>
+#include "Executor.h"
+
+namespace kls::coroutine {
+    struct ScalingLimits {
+        int min; // threads kept alive while idle
+        int max; // threads never exceeded
+        std::chrono::milliseconds linger; // how long a parked thread waits before asking to retire
+    };
+
+    enum class ScalingDecision { Hold, Spawn, Retire };
+
+    // what the executor measured when it asked for a decision
+    struct ScalingSample {
+        enum class Reason {
+            Saturated, // work was enqueued, or a worker ran a streak of tasks, while no thread was parked
+            SlowQueue, // a sampled task waited in the queue for long
+            Idle, // a thread stayed parked for the whole linger period
+            Blocking, // a thread entered or left a blocking section, the policy is not asked for these
+            Stalled // a timed task stayed queued with no thread parked for the stall span, nor for these
+        };
+        Reason reason;
+        int threads, parked, blocked; // threads counts those that are blocked as well
+
+        ScalingLimits limits;
+        std::chrono::nanoseconds queue_wait; // smoothed time sampled tasks spent queued before running
+        double utilization; // smoothed share of thread time spent outside of parking, from 0 to 1
+        std::chrono::steady_clock::time_point now;
+    };
+
+    // emitted after every spawn and retire, with the thread count after the change
+    struct ScalingEvent {
+        ScalingDecision decision;
+        int threads;
+        ScalingSample sample;
+    };
+
+    // decides when a scaling executor grows or shrinks. the executor makes all calls under one of its locks, so a
+    // policy can keep plain state but must not enqueue work on that executor. min and max are enforced by the
+    // executor itself: it spawns below min and retires idle threads above max whatever the policy says, and
+    // ignores decisions that would cross either limit. a task left queued for long while no thread is parked gets
+    // a thread below max without asking, the event is still recorded. threads inside a BlockingSection count
+    // against neither
+    class IScalingPolicy {
+    public:
+        ScalingDecision decide(const ScalingSample &sample) noexcept { return (*this.*Decide)(sample); }
+
+        void record(const ScalingEvent &event) noexcept { (*this.*Record)(event); }
+
+    protected:
+        using FnDecide = ScalingDecision (IScalingPolicy::*)(const ScalingSample &sample) noexcept;
+        using FnRecord = void (IScalingPolicy::*)(const ScalingEvent &event) noexcept;
+
+        IScalingPolicy(FnDecide decide, FnRecord record) noexcept: Decide{decide}, Record{record} {}
+
+    private:
+        FnDecide Decide;
+        FnRecord Record;
+    };
+
+    // the default policy. it spawns when sampled queue wait or utilization runs high and retires an idle
+    // thread only once both are well below those marks, so a short burst does not cause thread churn.
+    // a spawn it decides is at least spawn_interval after the last recorded one
+    class AdaptiveScalingPolicy : public IScalingPolicy {
+    public:
+        struct Options {
+            std::chrono::nanoseconds grow_wait{std::chrono::microseconds(500)};
+            double grow_utilization{0.9}; // only counts when no thread is parked
+            std::chrono::nanoseconds shrink_wait{std::chrono::microseconds(50)};
+            double shrink_utilization{0.5};
+            std::chrono::nanoseconds spawn_interval{std::chrono::milliseconds(5)};
+            // receives every scaling event, may be empty
+            std::function<void(const ScalingEvent &)> sink{};
+        };
+
+        AdaptiveScalingPolicy() noexcept: AdaptiveScalingPolicy(Options{}) {}
+
+        explicit AdaptiveScalingPolicy(Options options) noexcept;
+
+        [[nodiscard]] std::uint64_t spawned() const noexcept { return mSpawned.load(std::memory_order_relaxed); }
+
+        [[nodiscard]] std::uint64_t retired() const noexcept { return mRetired.load(std::memory_order_relaxed); }
+
+    private:
+        Options mOptions;
+        std::chrono::steady_clock::time_point mLastSpawn{};
+        std::atomic<std::uint64_t> mSpawned{0}, mRetired{0};
+
+        ScalingDecision DecideImpl(const ScalingSample &sample) noexcept;
+
+        void RecordImpl(const ScalingEvent &event) noexcept;
+    };
+
+    // runtime handle of a scaling executor
+    class ScalingControl : public AddressSensitive {
+    public:
+        [[nodiscard]] IExecutor *executor() const noexcept { return mExecutor; }
+
+        [[nodiscard]] int threads() const noexcept { return mTotal.load(std::memory_order_relaxed); }
+
+        [[nodiscard]] ScalingLimits limits() const noexcept {
+            return {
+                    mMin.load(std::memory_order_relaxed), mMax.load(std::memory_order_relaxed),
+                    std::chrono::milliseconds(mLinger.load(std::memory_order_relaxed))
+            };
+        }
+
+        // a raised min is filled on the next enqueue, a lowered max drains as threads go idle, and parked
+        // threads pick up a new linger the next time they park. max is kept at least 1 and at least min
+        void set_limits(ScalingLimits limits) noexcept;
+
+    protected:
+        ScalingControl(IExecutor *executor, ScalingLimits limits) noexcept: mExecutor(executor) {
+            set_limits(limits);
+        }
+
+        IExecutor *const mExecutor;
+        std::atomic_int mMin{0}, mMax{1};
+        std::atomic<std::chrono::milliseconds::rep> mLinger{0};
+        std::atomic_int mTotal{0};
+    };
+
+    // scaling executors with a pluggable policy. without one an AdaptiveScalingPolicy with default options is used
+    std::shared_ptr<ScalingControl> CreateScalingFIFOExecutor(
+            ScalingLimits limits, std::shared_ptr<IScalingPolicy> policy = {}
+    );
+
+    std::shared_ptr<ScalingControl> CreateScalingBagExecutor(
+            ScalingLimits limits, std::shared_ptr<IScalingPolicy> policy = {}
+    );
+
+    std::shared_ptr<ScalingControl> CreateScalingDeadlineExecutor(
+            ScalingLimits limits, bool demote_expired = true, std::shared_ptr<IScalingPolicy> policy = {}
+    );
+}
@@ -0,0 +1,114 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <optional>
+#include <exception>
+#include <type_traits>
+#include "When.h"
+#include "Cancellation.h"
+
+namespace kls::coroutine {
+    // A scope owning child tasks. Children are started with spawn() and all of them are joined with a single
+    // suspension. The first child failure cancels the group, as does cancel() or the cancellation of the
+    // parent token. Children observe it through token(): cancellable delays and waits given the token give up
+    // and throw OperationCancelled, which the group does not count as a failure once it is cancelled.
+    // The group has to be joined before it is destroyed if any child was spawned.
+    class TaskGroup : public AddressSensitive {
+    public:
+        TaskGroup() noexcept = default;
+
+        explicit TaskGroup(const CancellationToken &parent) { m_parent.emplace(parent.native(), Cancel{*this}); }
+
+        ~TaskGroup() noexcept { assert(m_pending.load() <= 1); }
+
+        [[nodiscard]] CancellationToken token() const noexcept { return m_source.token(); }
+
+        [[nodiscard]] bool cancelled() const noexcept { return m_source.cancelled(); }
+
+        bool cancel() noexcept { return m_source.cancel(); }
+
+        // Invokes fn, with the group token if it takes one, and awaits the result as a child of the group. fn
+        // may also be an awaitable to be awaited directly. It is moved into the child first, so a coroutine
+        // lambda can capture by reference safely. Nothing is started once the group is cancelled.
+        template<class Fn>
+        void spawn(Fn &&fn) {
+            if (cancelled()) return;
+            m_pending.fetch_add(1);
+            child(*this, std::forward<Fn>(fn));
+        }
+
+        // suspends until every child has finished, then rethrows the first failure
+        auto join() noexcept {
+            struct Join {
+                TaskGroup &group;
+                [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+                bool await_suspend(std::coroutine_handle<> h) {
+                    if (group.m_pending.fetch_sub(1) == 1) return false;
+                    return group.m_entry.set_handle(h), group.m_trigger.trap(group.m_entry);
+                }
+                void await_resume() const { if (group.m_error) std::rethrow_exception(group.m_error); }
+            };
+            return Join{*this};
+        }
+    private:
+        struct Cancel {
+            TaskGroup &group;
+            void operator()() const noexcept { group.cancel(); }
+        };
+
+        // one extra count is held by the joining side, like WhenAllControl
+        std::atomic_size_t m_pending{1};
+        std::atomic_bool m_failed{false};
+        std::exception_ptr m_error{nullptr};
+        CancellationSource m_source{};
+        SingleExecutorTrigger m_trigger{};
+        ExecutorAwaitEntry m_entry{};
+        std::optional<std::stop_callback<Cancel>> m_parent{};
+
+        void fail() noexcept {
+            if (!m_failed.exchange(true)) m_error = std::current_exception();
+            cancel();
+        }
+
+        void arrive() { if (m_pending.fetch_sub(1) == 1) m_trigger.pull(); }
+
+        template<class Fn>
+        static detail::WhenTask child(TaskGroup &group, Fn fn) {
+            try {
+                if constexpr (std::is_invocable_v<Fn &, CancellationToken>) co_await fn(group.token());
+                else if constexpr (std::is_invocable_v<Fn &>) co_await fn();
+                else co_await std::move(fn);
+            }
+            catch (const OperationCancelled &) {
+                if (!group.cancelled()) group.fail();
+            }
+            catch (...) {
+                group.fail();
+            }
+            group.arrive();
+        }
+    };
+}
@@ -24,6 +24,7 @@
 
 #include <chrono>
 #include "Trigger.h"
+#include "Cancellation.h"
 
 namespace kls::coroutine {
     struct DelayAwait: private SingleExecutorTrigger, private ExecutorAwaitEntry {
@@ -41,10 +42,37 @@ namespace kls::coroutine {
         constexpr void await_resume() const noexcept {}
     };
 
+    namespace detail {
+        // only enters the timer queue when awaited, and leaves it again when the wait is cancelled
+        class DelayCore: private SingleExecutorTrigger, private ExecutorAwaitEntry {
+        public:
+            explicit DelayCore(std::chrono::steady_clock::time_point tp) noexcept: m_time(tp) {}
+
+            bool trap(std::coroutine_handle<> h);
+
+            bool cancel() noexcept;
+
+            constexpr void get() const noexcept {}
+
+            using ExecutorAwaitEntry::resume_async;
+        private:
+            std::chrono::steady_clock::time_point m_time;
+        };
+    }
+
+    using CancellableDelayAwait = detail::CancellableAwait<detail::DelayCore>;
+
     DelayAwait delay_until(std::chrono::steady_clock::time_point tp);
 
+    CancellableDelayAwait delay_until(std::chrono::steady_clock::time_point tp, CancellationToken token);
+
     template<class Rep, class Period>
     DelayAwait wait_for(const std::chrono::duration<Rep, Period>& rel) {
         return delay_until(std::chrono::steady_clock::now() + rel);
     }
+
+    template<class Rep, class Period>
+    CancellableDelayAwait wait_for(const std::chrono::duration<Rep, Period>& rel, CancellationToken token) {
+        return delay_until(std::chrono::steady_clock::now() + rel, std::move(token));
+    }
 }
\ No newline at end of file
@@ -67,22 +67,51 @@ namespace kls::coroutine {
 
     class ExecutorAwaitEntry: public AddressSensitive {
     public:
-        ExecutorAwaitEntry() noexcept: m_exec(this_executor()) {}
+        // the waiter keeps the deadline it was running under, not the one of whoever resumes it
+        ExecutorAwaitEntry() noexcept: m_exec(this_executor()), m_deadline(this_deadline()) {}
 
-        explicit ExecutorAwaitEntry(IExecutor *next) noexcept: m_exec(next) {}
+        explicit ExecutorAwaitEntry(IExecutor *next) noexcept: m_exec(next), m_deadline(this_deadline()) {}
+
+        ExecutorAwaitEntry(IExecutor *next, Deadline deadline) noexcept: m_exec(next), m_deadline(deadline) {}
+
+        // a concrete executor type is resumed onto through a post function made for it, which calls the enqueue
+        // of that type and skips the one of IExecutor. triggers resume out of line, so the post stays an
+        // indirect call and nothing past it is inlined into the waiter
+        template<detail::TypedExecutor Exec>
+        explicit ExecutorAwaitEntry(Exec *next) noexcept: ExecutorAwaitEntry(next, this_deadline()) {}
+
+        template<detail::TypedExecutor Exec>
+        ExecutorAwaitEntry(Exec *next, Deadline deadline) noexcept:
+                m_exec(next), m_post(&detail::Post<Exec>), m_deadline(deadline) {}
 
         void destroy() noexcept { m_handle.destroy(); }
 
         void set_handle(std::coroutine_handle<> handle) noexcept { m_handle = handle; }
 
-        void resume_async() { if (m_exec) m_exec->enqueue(m_handle); else m_handle.resume(); }
+        // the entry lives in the frame of the waiter, so it is queued in place
+        void resume_async() { if (m_exec) enqueue(); else resume_inline(); }
 
         bool resumable_inplace(IExecutor *now) const noexcept { return (now == m_exec) || (!m_exec); }
 
-        void resume_exec(IExecutor *now) { if (now != m_exec) m_exec->enqueue(m_handle); else m_handle.resume(); }
+        void resume_exec(IExecutor *now) { if (now != m_exec) enqueue(); else resume_inline(); }
     private:
         IExecutor *m_exec;
+        detail::FnPost m_post{nullptr};
+        Deadline m_deadline;
         std::coroutine_handle<> m_handle{};
+        // the waiter keeps its tag as well, and its queue wait is counted as a wake by latency recorders
+        TaskNode m_node{ .tag = this_tag(), .woken = true };
+
+        // a tagged waiter runs under its own tag until it suspends again, an untagged one under that of the resumer
+        void resume_inline() {
+            if (!m_node.tag) return m_handle.resume();
+            TagScope scope{*m_node.tag};
+            m_handle.resume();
+        }
+
+        void enqueue() noexcept {
+            if (m_post) m_post(m_exec, m_node, m_handle, m_deadline); else m_exec->enqueue(m_node, m_handle, m_deadline);
+        }
     };
 
     class SingleExecutorTrigger: public AddressSensitive {
@@ -92,6 +121,9 @@ namespace kls::coroutine {
         void drop() noexcept;
 
         void pull();
+
+        // takes a trapped entry back. returns false if the trigger has already claimed it for resumption
+        bool cancel(ExecutorAwaitEntry& h) noexcept;
     private:
         std::atomic<void *> m_captured{nullptr};
     };
@@ -114,6 +146,8 @@ namespace kls::coroutine {
         void drop() noexcept;
 
         void pull();
+
+        bool cancel(FifoExecutorAwaitEntry& next) noexcept;
     private:
         thread::SpinLock m_lock{};
         std::atomic_bool m_done{false};
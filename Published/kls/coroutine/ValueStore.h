@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <memory>
 #include <exception>
 #include "kls/Object.h"
 
@@ -88,4 +89,17 @@ namespace kls::coroutine {
         Storage <T> m_store;
         bool m_set{false};
     };
+
+    // holds on to a borrowed object, which the owner keeps alive for as long as the store is set
+    template<class T>
+    class ValueStore<T &> {
+    public:
+        void set(T &v) noexcept { m_ptr = std::addressof(v); }
+        T &get() noexcept { return *m_ptr; }
+        T &ref() noexcept { return *m_ptr; }
+        T &copy() noexcept { return *m_ptr; }
+        void reset() noexcept { m_ptr = nullptr; }
+    private:
+        T *m_ptr{nullptr};
+    };
 }
@@ -0,0 +1,272 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <tuple>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <vector>
+#include <variant>
+#include <utility>
+#include "Traits.h"
+#include "Trigger.h"
+#include "ValueStore.h"
+#include "Cancellation.h"
+
+namespace kls::coroutine::detail {
+    template<class A>
+    using when_result_t = std::remove_cvref_t<awaitable_result_t<std::remove_reference_t<A>>>;
+
+    template<class T>
+    using when_value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+    template<class T>
+    concept when_range = requires(T &c) {
+        std::begin(c);
+        std::size(c);
+    };
+
+    // an eagerly started coroutine that frees its own frame on completion. used for launching child awaits
+    struct WhenTask {
+        struct promise_type {
+            constexpr WhenTask get_return_object() const noexcept { return {}; }
+            constexpr std::suspend_never initial_suspend() const noexcept { return {}; }
+            constexpr std::suspend_never final_suspend() const noexcept { return {}; }
+            constexpr void return_void() const noexcept {}
+            void unhandled_exception() const noexcept { std::terminate(); }
+        };
+    };
+
+    // await the child and store the outcome. the 'Host' is notified after the store is written
+    template<class R, class A, class Host>
+    WhenTask when_all_child(A &a, FutureStore<R> &store, Host &host) {
+        try {
+            if constexpr(std::is_void_v<R>) co_await std::move(a), store.set(); else store.set(co_await std::move(a));
+        }
+        catch (...) {
+            store.fail(std::current_exception());
+        }
+        host.arrive();
+    }
+
+    template<class R>
+    when_value_t<R> when_take(FutureStore<R> &store) {
+        if constexpr(std::is_void_v<R>) return store.get(), std::monostate{}; else return store.get();
+    }
+
+    // the counter starts with one extra slot held by the launching side, so that children finishing
+    // during the launch can never resume the parent before it is suspended
+    class WhenAllControl : public AddressSensitive {
+    public:
+        void start(std::size_t count) noexcept { m_remaining.store(count + 1); }
+        void arrive() { if (m_remaining.fetch_sub(1) == 1) m_trigger.pull(); }
+        bool trap(std::coroutine_handle<> h) {
+            if (m_remaining.fetch_sub(1) == 1) return false;
+            return m_entry.set_handle(h), m_trigger.trap(m_entry);
+        }
+    private:
+        std::atomic_size_t m_remaining{0};
+        SingleExecutorTrigger m_trigger{};
+        ExecutorAwaitEntry m_entry{};
+    };
+
+    template<class ...A>
+    class WhenAll : public AddressSensitive {
+        using Indices = std::index_sequence_for<A...>;
+    public:
+        template<class ...U>
+        explicit WhenAll(U &&... a): m_awaitables(std::forward<U>(a)...) {}
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return sizeof...(A) == 0; }
+        bool await_suspend(std::coroutine_handle<> h) { return launch(Indices{}), m_control.trap(h); }
+        auto await_resume() { return collect(Indices{}); }
+    private:
+        std::tuple<A...> m_awaitables;
+        std::tuple<FutureStore<when_result_t<A>>...> m_results{};
+        WhenAllControl m_control{};
+
+        template<std::size_t ...I>
+        void launch(std::index_sequence<I...>) {
+            m_control.start(sizeof...(A));
+            (..., when_all_child(std::get<I>(m_awaitables), std::get<I>(m_results), m_control));
+        }
+
+        template<std::size_t ...I>
+        auto collect(std::index_sequence<I...>) {
+            return std::tuple<when_value_t<when_result_t<A>>...>{when_take(std::get<I>(m_results))...};
+        }
+    };
+
+    template<class Container>
+    class WhenAllRange : public AddressSensitive {
+        using R = when_result_t<decltype(*std::begin(std::declval<Container &>()))>;
+    public:
+        explicit WhenAllRange(Container c): m_awaitables(std::move(c)) {}
+        [[nodiscard]] bool await_ready() const noexcept { return std::empty(m_awaitables); }
+        bool await_suspend(std::coroutine_handle<> h) {
+            const auto count = std::size(m_awaitables);
+            m_results = std::make_unique<FutureStore<R>[]>(count);
+            m_control.start(count);
+            auto it = m_results.get();
+            for (auto &&x: m_awaitables) when_all_child(x, *it++, m_control);
+            return m_control.trap(h);
+        }
+        auto await_resume() {
+            const auto count = std::size(m_awaitables);
+            if constexpr(std::is_void_v<R>) {
+                for (std::size_t i = 0; i < count; ++i) m_results[i].get();
+            } else {
+                std::vector<R> result{};
+                result.reserve(count);
+                for (std::size_t i = 0; i < count; ++i) result.push_back(m_results[i].get());
+                return result;
+            }
+        }
+    private:
+        Container m_awaitables;
+        std::unique_ptr<FutureStore<R>[]> m_results{};
+        WhenAllControl m_control{};
+    };
+
+    // state shared between the parent and the children of when_any. the first child to complete cancels the
+    // waits of the others, then publishes its result and resumes the parent
+    template<class Result>
+    class WhenAnyState {
+    public:
+        // the cancelled losers are resumed inline from here and fail their own claim
+        bool claim() noexcept { return !m_won.exchange(true) && (m_losers.cancel(), true); }
+        [[nodiscard]] CancellationToken token() const noexcept { return m_losers.token(); }
+        template<std::size_t I, class ...U>
+        void set(std::size_t index, U &&... v) {
+            m_index = index, m_result.template emplace<I>(std::forward<U>(v)...), m_trigger.pull();
+        }
+        void fail(std::size_t index) { m_index = index, m_fail = std::current_exception(), m_trigger.pull(); }
+        bool trap(std::coroutine_handle<> h) { return m_entry.set_handle(h), m_trigger.trap(m_entry); }
+        std::size_t index() const noexcept { return m_index; }
+        Result &&get() { if (m_fail) std::rethrow_exception(m_fail); else return std::move(m_result); }
+    private:
+        std::atomic_bool m_won{false};
+        CancellationSource m_losers{};
+        std::size_t m_index{0};
+        Result m_result{};
+        std::exception_ptr m_fail{nullptr};
+        SingleExecutorTrigger m_trigger{};
+        ExecutorAwaitEntry m_entry{};
+    };
+
+    template<class A>
+    concept when_detachable = requires(A a, CancellationToken t) { std::move(a).cancellable(t, (IExecutor *) nullptr); };
+
+    // a child that can be awaited cancellably is awaited without an executor, so it resumes where it completes
+    // or where the winner cancels it. no loser is left bound to the executor of the parent
+    template<class A>
+    decltype(auto) when_any_await(A &a, const CancellationToken &token) {
+        if constexpr(when_detachable<A>) return std::move(a).cancellable(token, (IExecutor *) nullptr);
+        else return std::move(a);
+    }
+
+    template<std::size_t I, class A, class State>
+    WhenTask when_any_child(A a, std::shared_ptr<State> state, std::size_t index) {
+        using R = when_result_t<A>;
+        try {
+            if constexpr(std::is_void_v<R>) {
+                co_await when_any_await(a, state->token());
+                if (state->claim()) state->template set<I>(index);
+            } else {
+                auto result = co_await when_any_await(a, state->token());
+                if (state->claim()) state->template set<I>(index, std::move(result));
+            }
+        }
+        catch (...) {
+            if (state->claim()) state->fail(index);
+        }
+    }
+
+    template<class ...A>
+    class WhenAny : public AddressSensitive {
+        using Result = std::variant<when_value_t<when_result_t<A>>...>;
+        using State = WhenAnyState<Result>;
+        using Indices = std::index_sequence_for<A...>;
+    public:
+        template<class ...U>
+        explicit WhenAny(U &&... a): m_awaitables(std::forward<U>(a)...) {}
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) { return launch(Indices{}), m_state->trap(h); }
+        std::pair<std::size_t, Result> await_resume() { return {m_state->index(), m_state->get()}; }
+    private:
+        std::tuple<A...> m_awaitables;
+        std::shared_ptr<State> m_state{std::make_shared<State>()};
+
+        template<std::size_t ...I>
+        void launch(std::index_sequence<I...>) {
+            (..., when_any_child<I>(std::move(std::get<I>(m_awaitables)), m_state, I));
+        }
+    };
+
+    template<class Container>
+    class WhenAnyRange : public AddressSensitive {
+        using R = when_result_t<decltype(*std::begin(std::declval<Container &>()))>;
+        using Result = std::variant<when_value_t<R>>;
+        using State = WhenAnyState<Result>;
+    public:
+        explicit WhenAnyRange(Container c): m_awaitables(std::move(c)) {}
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) {
+            std::size_t index = 0;
+            for (auto &&x: m_awaitables) when_any_child<0>(std::move(x), m_state, index++);
+            return m_state->trap(h);
+        }
+        std::pair<std::size_t, when_value_t<R>> await_resume() {
+            return {m_state->index(), std::get<0>(m_state->get())};
+        }
+    private:
+        Container m_awaitables;
+        std::shared_ptr<State> m_state{std::make_shared<State>()};
+    };
+}
+
+namespace kls::coroutine {
+    // Launches all awaitables at once and suspends a single time until every one of them has completed.
+    // Lvalue awaitables are awaited in place and must outlive the returned awaiter, rvalues are moved in.
+    // Results are returned as a tuple with void results replaced by std::monostate. If any child failed,
+    // the first failure in argument order is rethrown.
+    template<class ...U>
+    requires (... && !detail::when_range<U>)
+    auto when_all(U &&... a) { return detail::WhenAll<U...>(std::forward<U>(a)...); }
+
+    // Range form of when_all. The results are returned in a vector, or nothing for void awaitables.
+    template<detail::when_range Container>
+    auto when_all(Container c) { return detail::WhenAllRange<Container>(std::move(c)); }
+
+    // Launches all awaitables at once and resumes with the index and the result of the first one to complete.
+    // The children are moved into their own frames. Those with cancellable(token, executor), like ValueAsync,
+    // are awaited detached from the caller's executor, and their waits are cancelled before the caller resumes:
+    // the losing tasks run on, but nothing of when_any is left waiting for them. Other awaitables finish in the
+    // background and resume on the caller's executor, which has to outlive them.
+    template<class ...U>
+    requires (... && !detail::when_range<U>)
+    auto when_any(U &&... a) { return detail::WhenAny<std::decay_t<U>...>(std::forward<U>(a)...); }
+
+    template<detail::when_range Container>
+    auto when_any(Container c) { return detail::WhenAnyRange<Container>(std::move(c)); }
+}
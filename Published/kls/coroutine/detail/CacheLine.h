@@ -22,22 +22,22 @@
 
 #pragma once
 
-#include <coroutine>
+#include <new>
+#include <cstddef>
 
 namespace kls::coroutine::detail {
-    template<template<class> class Queue, class Task>
-    class QueueDrain {
-    public:
-        void Add(const Task &t) { mQueue.Add(t); }
-
-        void Drain() noexcept {
-            for (;;) if (auto exec = mQueue.Get(); exec) std::coroutine_handle<>::from_address(exec).resume(); else return;
-        }
-
-        [[nodiscard]] bool ShouldActive() noexcept { return mQueue.SnapshotNotEmpty(); }
-
-        void Finalize() { mQueue.Finalize(); }
-    private:
-        Queue<Task> mQueue;
-    };
+    // members written by different threads are aligned to this so they do not share a cache line
+#if defined(__cpp_lib_hardware_interference_size)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+// only used for the layout of types that never cross a library boundary
+#pragma GCC diagnostic ignored "-Winterference-size"
+#endif
+    inline constexpr std::size_t CacheLine = std::hardware_destructive_interference_size;
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#else
+    inline constexpr std::size_t CacheLine = 64;
+#endif
 }
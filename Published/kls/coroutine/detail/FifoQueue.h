@@ -0,0 +1,130 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <type_traits>
+#include "CacheLine.h"
+#include "Worker.h"
+#include "kls/thread/SpinLock.h"
+
+namespace kls::coroutine::detail {
+    // intrusive list of TaskNode. plain handles ride on nodes recycled through a free list, so the queue stops
+    // allocating once it has seen its peak depth, and callers that bring their own node never make it allocate
+    template<class Task, bool Fast = false>
+    class FifoQueue {
+        static_assert(std::is_same_v<Task, void*>, "the queue links TaskNode, which carries a raw handle");
+    public:
+        FifoQueue() = default;
+
+        FifoQueue(const FifoQueue&) = delete;
+
+        FifoQueue& operator=(const FifoQueue&) = delete;
+
+        ~FifoQueue() noexcept {
+            for (auto node = mFree; node;) delete std::exchange(node, node->next);
+            for (auto node = mHead; node;) {
+                const auto next = node->next;
+                if (node->pooled) delete node;
+                node = next;
+            }
+        }
+
+        // a recycled node is taken and linked in one go, only a node that has to be allocated takes the lock twice
+        void Add(const Task& t) {
+            const auto tag = this_tag();
+            const auto queued = QueueStamp();
+            {
+                std::lock_guard lk{ mSpin };
+                if (const auto node = mFree) {
+                    mFree = node->next;
+                    node->next = nullptr, node->handle = t, node->tag = tag, node->queued = queued;
+                    return LinkLocked(node);
+                }
+            }
+            const auto node = new TaskNode{ .pooled = true };
+            node->next = nullptr, node->handle = t, node->tag = tag, node->queued = queued;
+            Link(node);
+        }
+
+        // the node stays owned by the caller and has to outlive its turn in the queue
+        void Link(TaskNode* node) noexcept {
+            std::lock_guard lk{ mSpin };
+            LinkLocked(node);
+        }
+
+        [[nodiscard]] Task Get() noexcept {
+            TaskTrace trace{};
+            return Get(trace);
+        }
+
+        // also hands out the tag and enqueue stamp the task was queued with
+        [[nodiscard]] Task Get(TaskTrace& trace) noexcept {
+            if (auto exec = LockedPop(trace); exec) return exec;
+            if constexpr (!Fast) {
+                thread::SpinWait spinner{};
+                for (auto i = 0u; i < thread::SpinWait::SpinCountForSpinBeforeWait; ++i) {
+                    spinner.once();
+                    if (auto exec = LockedPop(trace); exec) return exec;
+                }
+            }
+            return {};
+        }
+
+        // safe to poll from any thread without taking the lock
+        [[nodiscard]] bool SnapshotNotEmpty() const noexcept { return mSize.load(std::memory_order_acquire) != 0; }
+
+        void Finalize() noexcept {}
+
+        void Detach() noexcept {}
+    private:
+        // waiters spin on the lock line, so the list the holder works on is kept off it. the size is polled by
+        // idle threads and gets a line of its own as well
+        alignas(CacheLine) thread::SpinLock mSpin{};
+        alignas(CacheLine) TaskNode* mHead{ nullptr };
+        TaskNode* mTail{ nullptr };
+        TaskNode* mFree{ nullptr };
+        alignas(CacheLine) std::atomic_size_t mSize{ 0 };
+
+        void LinkLocked(TaskNode* node) noexcept {
+            if (mTail) mTail->next = node; else mHead = node;
+            mTail = node;
+            mSize.store(mSize.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // the handle and trace are read before the node is let go: a caller-owned node may vanish as soon as its coroutine
+        // is resumed by whoever popped it
+        Task LockedPop(TaskTrace& trace) noexcept {
+            std::lock_guard lk{ mSpin };
+            const auto node = mHead;
+            if (!node) return {};
+            if (!(mHead = node->next)) mTail = nullptr;
+            mSize.store(mSize.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            const auto task = node->handle;
+            trace = { node->tag, node->queued, node->woken };
+            if (node->pooled) node->next = mFree, mFree = node;
+            return task;
+        }
+    };
+}
@@ -0,0 +1,78 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <utility>
+#include <coroutine>
+#include "Worker.h"
+
+namespace kls::coroutine::detail {
+    template<template<class> class Queue, class Task>
+    class QueueDrain {
+    public:
+        template<class ...U>
+        explicit QueueDrain(U &&... args): mQueue(std::forward<U>(args)...) {}
+
+        void Add(const Task &t) { mQueue.Add(t); }
+
+        // only for queues that take caller-owned nodes
+        void Link(TaskNode *node) noexcept { mQueue.Link(node); }
+
+        void Drain() noexcept { Drain([](Task) noexcept {}); }
+
+        // before is called with every task right ahead of resuming it
+        template<class Fn>
+        void Drain(Fn &&before) noexcept {
+            for (;;) if (!RunOne(before)) return;
+        }
+
+        bool RunOne() noexcept { return RunOne([](Task) noexcept {}); }
+
+        template<class Fn>
+        bool RunOne(Fn &&before) noexcept {
+            TaskTrace trace{};
+            if (auto exec = Get(trace); exec) return (Run(exec, trace, before), true);
+            return false;
+        }
+
+        [[nodiscard]] bool ShouldActive() noexcept { return mQueue.SnapshotNotEmpty(); }
+
+        void Finalize() { mQueue.Finalize(); }
+
+        // called by a draining thread that is about to exit
+        void Detach() noexcept { mQueue.Detach(); }
+    private:
+        Queue<Task> mQueue;
+
+        // queues that do not keep a trace hold the traced handle IExecutor::enqueue made of the node instead
+        Task Get(TaskTrace &trace) noexcept {
+            if constexpr (requires { mQueue.Get(trace); }) return mQueue.Get(trace); else return mQueue.Get();
+        }
+
+        template<class Fn>
+        static void Run(Task exec, TaskTrace trace, Fn &before) noexcept {
+            before(exec);
+            ResumeTask(exec, trace);
+        }
+    };
+}
@@ -0,0 +1,56 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace kls::coroutine::detail {
+    // a cpu relax hint for spin loops, no-op where there is none
+    inline void CpuRelax() noexcept {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__) && !defined(_MSC_VER)
+        asm volatile("yield");
+#endif
+    }
+
+    // polls ready for up to spin, backing off from pause to yield. false if it never turned true
+    template<class Ready>
+    bool SpinFor(std::chrono::nanoseconds spin, Ready &&ready) noexcept {
+        if (spin <= std::chrono::nanoseconds::zero()) return false;
+        const auto forever = spin == std::chrono::nanoseconds::max();
+        const auto until = forever ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::now() + spin;
+        for (unsigned round = 0;; ++round) {
+            if (ready()) return true;
+            if (round < 8) { for (unsigned i = 0; i < (1u << round); ++i) CpuRelax(); }
+            else std::this_thread::yield();
+            // reading the clock is not free, so only do it every few rounds
+            if ((round & 15) == 15 && !forever && std::chrono::steady_clock::now() >= until) return false;
+        }
+    }
+}
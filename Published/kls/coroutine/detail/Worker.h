@@ -0,0 +1,90 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include "kls/coroutine/Executor.h"
+#include "kls/thread/Semaphore.h"
+
+// what a header-only executor such as PolicyExecutor needs from the library to run its workers, and nothing else.
+// not part of the API, it may change with any release
+namespace kls::coroutine::detail {
+	void SetCurrentExecutor(IExecutor* exec) noexcept;
+
+	// what a queue knows of a task besides its handle
+	struct TaskTrace {
+		const TaskTag* tag{ nullptr };
+		std::int64_t queued{ 0 };
+		bool woken{ false };
+	};
+
+	// value for TaskNode::queued, 0 unless profiling is on or a latency recorder is enabled
+	std::int64_t QueueStamp() noexcept;
+
+	// resumes a dequeued task under its tag, and accounts the run while profiling and in the latency recorder
+	// of the current executor
+	void ResumeTask(void* task, TaskTrace trace = {}) noexcept;
+
+	// a helping thread waiting for either new work in the executor it helps, or the task it is blocked on. the
+	// first of the thread and its wakers to claim an armed park decides: a waker signals it, while the thread
+	// itself goes on without waiting
+	class HelperPark {
+	public:
+		void arm() noexcept { m_armed.store(true); }
+		bool claim() noexcept { return m_armed.exchange(false); }
+		bool wake() noexcept { return claim() && (m_signal.signal(), true); }
+		void wait() noexcept { m_signal.wait(); }
+
+		HelperPark* next{ nullptr };
+	private:
+		std::atomic_bool m_armed{ false };
+		thread::Semaphore m_signal{};
+	};
+
+	// an executor whose queue can be run by a thread that is blocked inside one of its workers
+	class IHelpable {
+	public:
+		// runs at most one queued task, returns false if nothing was ready
+		bool help_once() noexcept { return (*this.*HelpOnce)(); }
+
+		// a worker is about to block outside of the executor (enter) or is back from it
+		void blocking(bool enter) noexcept { (*this.*Blocking)(enter); }
+
+		// adds an armed park to the ones woken when work is queued (enter) or takes it out again. entering
+		// returns whether work was queued already, which the enqueue may not have seen the park for
+		bool park(HelperPark& park, bool enter) noexcept { return (*this.*Park)(park, enter); }
+	protected:
+		using FnHelpOnce = bool (IHelpable::*)() noexcept;
+		using FnBlocking = void (IHelpable::*)(bool enter) noexcept;
+		using FnPark = bool (IHelpable::*)(HelperPark& park, bool enter) noexcept;
+
+		IHelpable(FnHelpOnce help, FnBlocking blocking, FnPark park) noexcept:
+			HelpOnce{ help }, Blocking{ blocking }, Park{ park } {}
+	private:
+		FnHelpOnce HelpOnce;
+		FnBlocking Blocking;
+		FnPark Park;
+	};
+
+	void SetCurrentHelpable(IHelpable* exec) noexcept;
+}
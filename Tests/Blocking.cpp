@@ -20,9 +20,15 @@
 * SOFTWARE.
 */
 
+#include <latch>
+#include <functional>
 #include <string>
+#include <thread>
 #include <gtest/gtest.h>
+#include "kls/coroutine/Timed.h"
+#include "kls/coroutine/Scaling.h"
 #include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
 
 TEST(kls_coroutine, VoidBlockingSuccess) {
     using namespace kls::coroutine;
@@ -53,3 +59,94 @@ TEST(kls_coroutine, NonTrivialBlockingFailure) {
     using namespace kls::coroutine;
     EXPECT_ANY_THROW(run_blocking([&]() -> ValueAsync<std::string> { throw std::runtime_error(""); }));
 }
+
+TEST(kls_coroutine, NestedBlockingRestoresExecutor) {
+    using namespace kls::coroutine;
+    EXPECT_EQ(run_blocking([&]() -> ValueAsync<int> {
+        const auto outer = this_executor();
+        const auto inner = run_blocking([&]() -> ValueAsync<int> { co_await Redispatch{}; co_return 21; });
+        EXPECT_EQ(this_executor(), outer);
+        co_await Redispatch{};
+        co_return inner * 2;
+    }), 42);
+    EXPECT_EQ(this_executor(), nullptr);
+}
+
+TEST(kls_coroutine, BlockingHelpsWorker) {
+    using namespace kls::coroutine;
+    // a single worker would deadlock on a sync-over-async call that needs the same pool
+    auto executor = CreateScalingFIFOExecutor(1, 1, 100);
+    EXPECT_EQ(run_blocking([&]() -> ValueAsync<int> {
+        co_await SwitchTo(executor.get());
+        const auto inner = run_blocking([&]() -> ValueAsync<int> {
+            co_await SwitchTo(executor.get());
+            co_await Redispatch{};
+            co_return 21;
+        });
+        EXPECT_EQ(this_executor(), executor.get());
+        co_return inner * 2;
+    }), 42);
+}
+
+TEST(kls_coroutine, BlockingNestsPastHelpDepth) {
+    using namespace kls::coroutine;
+    // every level blocks the worker below it. past the helping depth the pool stands in for the blocked thread
+    auto executor = CreateScalingFIFOExecutor(1, 1, 100);
+    std::function<ValueAsync<int>(int)> nest = [&](int depth) -> ValueAsync<int> {
+        co_await SwitchTo(executor.get());
+        if (depth == 0) co_return 0;
+        co_return 1 + run_blocking([&, depth] { return nest(depth - 1); });
+    };
+    EXPECT_EQ(run_blocking([&] { return nest(8); }), 8);
+}
+
+TEST(kls_coroutine, BlockingRestoresDeadline) {
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+    // the helping worker looks for work on the deadline queue, which makes the deadline of whatever it finds
+    // current, or none once it is empty. the inner task ends elsewhere and mostly wakes the other worker
+    auto executor = CreateScalingDeadlineExecutor(2, 2, 100);
+    auto other = CreateScalingFIFOExecutor(1, 1, 100);
+    const auto deadline = std::chrono::steady_clock::now() + 1h;
+    EXPECT_TRUE(run_blocking([&]() -> ValueAsync<bool> {
+        co_await SwitchTo(executor.get(), deadline);
+        run_blocking([&]() -> ValueAsync<void> {
+            co_await SwitchTo(other.get());
+            co_await wait_for(5ms);
+        });
+        co_return this_deadline() == deadline;
+    }));
+}
+
+TEST(kls_coroutine, BlockingSectionCompensates) {
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+    // the only worker blocks on work queued behind it, which runs on the thread standing in for it
+    auto control = CreateScalingFIFOExecutor({1, 1, 100ms});
+    const auto executor = control->executor();
+    std::latch entered{1}, release{1};
+    int stand_ins = 0;
+    run_blocking([&]() -> ValueAsync<void> {
+        const auto wait = [&]() -> ValueAsync<void> {
+            co_await SwitchTo(executor);
+            call_blocking([&] {
+                BlockingSection nested{};
+                entered.count_down();
+                release.wait();
+            });
+        };
+        auto waiter = wait();
+        entered.wait();
+        co_await SwitchTo(executor);
+        stand_ins = control->threads() - 1;
+        release.count_down();
+        co_await std::move(waiter);
+    });
+    EXPECT_EQ(stand_ins, 1);
+    // the stand-in retires without lingering
+    const auto end = std::chrono::steady_clock::now() + 1s;
+    while (control->threads() != 1 && std::chrono::steady_clock::now() < end) std::this_thread::sleep_for(1ms);
+    EXPECT_EQ(control->threads(), 1);
+    // no effect off a worker
+    { BlockingSection section{}; }
+}
@@ -0,0 +1,151 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <latch>
+#include <cstddef>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Operation.h"
+#include "kls/coroutine/PolicyExecutor.h"
+#include "kls/coroutine/detail/CacheLine.h"
+
+// contention benchmarks. they check that every hop ran where it was sent, the timings are printed for comparison
+namespace {
+    using namespace kls::coroutine;
+    using detail::CacheLine;
+
+    struct Packed {
+        std::atomic_long first{0}, second{0};
+    };
+
+    struct Separated {
+        alignas(CacheLine) std::atomic_long first{0};
+        alignas(CacheLine) std::atomic_long second{0};
+    };
+
+    static_assert(offsetof(Separated, second) - offsetof(Separated, first) >= CacheLine);
+
+    // hops that resumed on the executor they switched to. each task adds its count once, at the end
+    std::atomic_long gLanded{0};
+
+    template<class Pair>
+    double hammer(Pair &pair, long iterations) {
+        const auto start = std::chrono::steady_clock::now();
+        std::thread other([&]() { for (long i = 0; i < iterations; ++i) pair.second.fetch_add(1); });
+        for (long i = 0; i < iterations; ++i) pair.first.fetch_add(1);
+        other.join();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // every hop goes through the shared queue and the park counter of the executor
+    ValueAsync<void> hop(IExecutor *executor, int hops, std::latch &done) {
+        long landed = 0;
+        for (int i = 0; i < hops; ++i) co_await SwitchTo(executor), landed += this_executor() == executor;
+        gLanded += landed;
+        done.count_down();
+    }
+
+    // the same hop, made to hand over the bare handle as awaiters did before they carried a queue node
+    struct PlainSwitch {
+        IExecutor *next;
+
+        [[nodiscard]] constexpr bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) { next->enqueue(handle); }
+
+        constexpr void await_resume() noexcept {}
+    };
+
+    ValueAsync<void> plain_hop(IExecutor *executor, int hops, std::latch &done) {
+        long landed = 0;
+        for (int i = 0; i < hops; ++i) co_await PlainSwitch{executor}, landed += this_executor() == executor;
+        gLanded += landed;
+        done.count_down();
+    }
+
+    // the executor type is known, so the hop calls its enqueue directly
+    template<class Exec>
+    ValueAsync<void> typed_hop(Exec *executor, int hops, std::latch &done) {
+        long landed = 0;
+        for (int i = 0; i < hops; ++i) co_await SwitchTo(executor), landed += this_executor() == executor;
+        gLanded += landed;
+        done.count_down();
+    }
+
+    template<class Exec, class Hop>
+    double churn(Exec *executor, int tasks, int hops, Hop hop) {
+        std::latch done{tasks};
+        gLanded = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < tasks; ++i) hop(executor, hops, done);
+        done.wait();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double churn(IExecutor *executor, int tasks, int hops) { return churn(executor, tasks, hops, hop); }
+}
+
+TEST(kls_coroutine, BenchmarkFalseSharing) {
+    constexpr long iterations = 2000000;
+    Packed packed{};
+    Separated separated{};
+    const auto shared = hammer(packed, iterations);
+    const auto apart = hammer(separated, iterations);
+    std::printf("[ BENCH    ] two writers: one line %.2f ms, separate lines %.2f ms\n", shared, apart);
+    EXPECT_EQ(packed.first + packed.second, 2 * iterations);
+    EXPECT_EQ(separated.first + separated.second, 2 * iterations);
+}
+
+TEST(kls_coroutine, BenchmarkExecutorContention) {
+    using namespace kls::coroutine;
+    constexpr int tasks = 64, hops = 2000;
+    auto fifo = CreateScalingFIFOExecutor(4, 4, 100);
+    auto bag = CreateScalingBagExecutor(4, 4, 100);
+    const auto f = churn(fifo.get(), tasks, hops);
+    EXPECT_EQ(gLanded, tasks * hops);
+    const auto b = churn(bag.get(), tasks, hops);
+    EXPECT_EQ(gLanded, tasks * hops);
+    std::printf("[ BENCH    ] %d hops on 4 workers: fifo %.2f ms, bag %.2f ms\n", tasks * hops, f, b);
+}
+
+TEST(kls_coroutine, BenchmarkIntrusiveEnqueue) {
+    constexpr int tasks = 64, hops = 5000;
+    auto single = CreateSingleThreadExecutor();
+    const auto plain = churn(single.get(), tasks, hops, plain_hop);
+    EXPECT_EQ(gLanded, tasks * hops);
+    const auto linked = churn(single.get(), tasks, hops, hop);
+    EXPECT_EQ(gLanded, tasks * hops);
+    std::printf("[ BENCH    ] %d hops on one thread: pooled node %.2f ms, awaiter node %.2f ms\n", tasks * hops, plain, linked);
+}
+
+TEST(kls_coroutine, BenchmarkTypedSwitch) {
+    using Pool = PolicyExecutor<detail::FifoQueue, ParkIdle, FixedScaling>;
+    constexpr int tasks = 64, hops = 5000;
+    Pool pool{{1, 1, std::chrono::milliseconds(0)}};
+    const auto erased = churn(static_cast<IExecutor *>(&pool), tasks, hops, hop);
+    EXPECT_EQ(gLanded, tasks * hops);
+    const auto typed = churn(&pool, tasks, hops, typed_hop<Pool>);
+    EXPECT_EQ(gLanded, tasks * hops);
+    std::printf("[ BENCH    ] %d hops on one pooled thread: through IExecutor %.2f ms, typed %.2f ms\n", tasks * hops, erased, typed);
+}
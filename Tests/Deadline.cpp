@@ -0,0 +1,87 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <latch>
+#include <vector>
+#include <semaphore>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    // holds the only worker so that everything enqueued meanwhile is ordered by the queue alone
+    ValueAsync<void> occupy(IExecutor *executor, std::latch &started, std::binary_semaphore &gate) {
+        co_await SwitchTo(executor);
+        started.count_down();
+        gate.acquire();
+    }
+
+    ValueAsync<void> record(IExecutor *executor, Deadline deadline, int id, std::vector<int> &out, std::latch &done) {
+        co_await SwitchTo(executor, deadline);
+        out.push_back(id);
+        done.count_down();
+    }
+
+    std::vector<int> run_order(bool demote, const std::vector<Deadline> &deadlines) {
+        auto executor = CreateScalingDeadlineExecutor(1, 1, 100, demote);
+        std::latch started{1}, done{static_cast<std::ptrdiff_t>(deadlines.size())};
+        std::binary_semaphore gate{0};
+        std::vector<int> out;
+        occupy(executor.get(), started, gate);
+        started.wait();
+        for (int i = 0; i < static_cast<int>(deadlines.size()); ++i) record(executor.get(), deadlines[i], i, out, done);
+        gate.release();
+        done.wait();
+        return out;
+    }
+}
+
+TEST(kls_coroutine, DeadlineOrder) {
+    using namespace kls::coroutine;
+    const auto base = std::chrono::steady_clock::now() + 1h;
+    const auto order = run_order(true, {base + 3s, base, base + 2s, Deadline::max(), base + 1s});
+    EXPECT_EQ(order, (std::vector<int>{1, 4, 2, 0, 3}));
+}
+
+TEST(kls_coroutine, DeadlineExpiredLane) {
+    using namespace kls::coroutine;
+    const auto now = std::chrono::steady_clock::now();
+    const std::vector<Deadline> deadlines{now - 2s, now + 1h, now - 1s, Deadline::max()};
+    EXPECT_EQ(run_order(true, deadlines), (std::vector<int>{1, 3, 0, 2}));
+    EXPECT_EQ(run_order(false, deadlines), (std::vector<int>{0, 2, 1, 3}));
+}
+
+TEST(kls_coroutine, DeadlineInherited) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingDeadlineExecutor(1, 2, 100);
+    const auto deadline = std::chrono::steady_clock::now() + 1h;
+    run_blocking([&]() -> ValueAsync<void> {
+        EXPECT_EQ(this_deadline(), Deadline::max());
+        co_await SwitchTo(executor.get(), deadline);
+        EXPECT_EQ(this_deadline(), deadline);
+        co_await Redispatch{};
+        EXPECT_EQ(this_deadline(), deadline);
+    });
+}
@@ -0,0 +1,97 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <gtest/gtest.h>
+#include "kls/coroutine/Event.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    ValueAsync<> phases(IExecutor *executor, Barrier &barrier, std::atomic_int &count, int rounds) {
+        co_await SwitchTo(executor);
+        for (int i = 0; i < rounds; ++i) {
+            count.fetch_add(1);
+            co_await barrier.arrive_and_wait();
+        }
+    }
+
+    ValueAsync<> finish(IExecutor *executor, WaitGroup &group, std::atomic_int &count) {
+        co_await SwitchTo(executor);
+        count.fetch_add(1);
+        group.done();
+    }
+}
+
+TEST(kls_coroutine, AsyncEventSetReset) {
+    using namespace kls::coroutine;
+    AsyncEvent event{};
+    ASSERT_FALSE(event.ready());
+    event.set();
+    ASSERT_TRUE(event.ready());
+    run_blocking([&]() -> ValueAsync<> { co_await event; });
+    event.reset();
+    ASSERT_FALSE(event.ready());
+}
+
+TEST(kls_coroutine, LatchRelease) {
+    using namespace kls::coroutine;
+    run_blocking([&]() -> ValueAsync<> {
+        Latch latch{2};
+        auto wait = [](Latch &target) -> ValueAsync<> { co_await target; }(latch);
+        latch.count_down();
+        EXPECT_FALSE(latch.ready());
+        latch.count_down();
+        co_await std::move(wait);
+        EXPECT_TRUE(latch.ready());
+    });
+}
+
+TEST(kls_coroutine, WaitGroupRounds) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingBagExecutor(1, 4, 100);
+    std::atomic_int count{0};
+    WaitGroup group{};
+    run_blocking([&]() -> ValueAsync<> {
+        for (int round = 1; round <= 3; ++round) {
+            group.add(8);
+            for (int i = 0; i < 8; ++i) finish(executor.get(), group, count);
+            co_await group;
+            EXPECT_EQ(count.load(), round * 8);
+        }
+    });
+}
+
+TEST(kls_coroutine, BarrierPhases) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingBagExecutor(1, 4, 100);
+    std::atomic_int count{0};
+    Barrier barrier{4};
+    run_blocking([&]() -> ValueAsync<> {
+        co_await awaits(
+                phases(executor.get(), barrier, count, 10), phases(executor.get(), barrier, count, 10),
+                phases(executor.get(), barrier, count, 10), phases(executor.get(), barrier, count, 10)
+        );
+    });
+    EXPECT_EQ(count.load(), 40);
+}
@@ -0,0 +1,138 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <vector>
+#include <numeric>
+#include <system_error>
+#include <gtest/gtest.h>
+#include "kls/coroutine/File.h"
+#include "kls/coroutine/Blocking.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    std::filesystem::path scratch(const char *name) {
+        return std::filesystem::temp_directory_path() / (std::string("kls_coroutine_") + name);
+    }
+
+    std::vector<std::byte> pattern(std::size_t size) {
+        std::vector<std::byte> data(size);
+        for (std::size_t i = 0; i < size; ++i) data[i] = std::byte(i * 7 + i / 251);
+        return data;
+    }
+
+    ValueAsync<std::vector<std::byte>> collect(const File &file, ReadStreamOptions options) {
+        std::vector<std::byte> out;
+        auto stream = read_stream(file, options);
+        while (co_await stream.forward()) {
+            const auto chunk = stream.next();
+            EXPECT_LE(chunk.size(), options.chunk);
+            out.insert(out.end(), chunk.begin(), chunk.end());
+        }
+        co_return out;
+    }
+
+    // takes the first items and drops the stream with its reads in flight
+    ValueAsync<std::vector<std::byte>> head(const File &file, ReadStreamOptions options, int items) {
+        std::vector<std::byte> out;
+        auto stream = read_stream(file, options);
+        for (int i = 0; i < items; ++i) {
+            if (!co_await stream.forward()) break;
+            const auto chunk = stream.next();
+            out.insert(out.end(), chunk.begin(), chunk.end());
+        }
+        co_return out;
+    }
+}
+
+TEST(kls_coroutine, FileReadWrite) {
+    using namespace kls::coroutine;
+    const auto path = scratch("rw");
+    const auto data = pattern(10000);
+    run_blocking([&]() -> ValueAsync<void> {
+        const auto caller = this_executor();
+        {
+            auto file = co_await File::open(path, FileMode::Write);
+            EXPECT_EQ(this_executor(), caller);
+            EXPECT_EQ(co_await file.write_at(0, data), data.size());
+            co_await file.fsync();
+        }
+        auto file = co_await File::open(path, FileMode::Read);
+        EXPECT_EQ(co_await file.size(), data.size());
+        std::vector<std::byte> back(4000);
+        EXPECT_EQ(co_await file.read_at(8000, back), 2000u);
+        EXPECT_TRUE(std::equal(back.begin(), back.begin() + 2000, data.begin() + 8000));
+        EXPECT_EQ(co_await file.read_at(20000, back), 0u);
+    });
+    std::filesystem::remove(path);
+}
+
+TEST(kls_coroutine, FileOpenFailure) {
+    using namespace kls::coroutine;
+    EXPECT_THROW(run_blocking([&]() -> ValueAsync<void> {
+        co_await File::open(scratch("missing_dir") / "none", FileMode::Read);
+    }), std::system_error);
+}
+
+TEST(kls_coroutine, FileReadStream) {
+    using namespace kls::coroutine;
+    const auto path = scratch("stream");
+    const auto data = pattern(100000);
+    run_blocking([&]() -> ValueAsync<void> {
+        {
+            auto file = co_await File::open(path, FileMode::Write);
+            co_await file.write_at(0, data);
+        }
+        auto file = co_await File::open(path, FileMode::Read);
+        for (const bool mapped: {false, true}) {
+            const auto whole = co_await collect(file, {.chunk = 4096, .depth = 3, .mapped = mapped});
+            EXPECT_EQ(whole, data);
+            const auto tail = co_await collect(file, {.offset = 99000, .chunk = 512, .mapped = mapped});
+            EXPECT_TRUE(std::equal(tail.begin(), tail.end(), data.begin() + 99000, data.end()));
+        }
+    });
+    std::filesystem::remove(path);
+}
+
+TEST(kls_coroutine, FileReadStreamDroppedEarly) {
+    using namespace kls::coroutine;
+    const auto path = scratch("dropped");
+    const auto data = pattern(100000);
+    run_blocking([&]() -> ValueAsync<void> {
+        {
+            auto file = co_await File::open(path, FileMode::Write);
+            co_await file.write_at(0, data);
+        }
+        auto file = co_await File::open(path, FileMode::Read);
+        for (const bool mapped: {false, true}) {
+            const ReadStreamOptions options{.chunk = 4096, .depth = 4, .mapped = mapped};
+            // dropped before the first item, and after a few
+            const auto none = co_await head(file, options, 0);
+            EXPECT_TRUE(none.empty());
+            const auto first = co_await head(file, options, 3);
+            EXPECT_TRUE(std::equal(first.begin(), first.end(), data.begin(), data.begin() + 3 * 4096));
+            // the buffers given back are handed out again
+            EXPECT_EQ(co_await collect(file, options), data);
+        }
+    });
+    std::filesystem::remove(path);
+}
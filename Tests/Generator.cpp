@@ -0,0 +1,112 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <span>
+#include <string>
+#include <numeric>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Generator.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    AsyncGenerator<int> count(int n) { for (int i = 0; i < n; ++i) co_yield int(i); }
+
+    AsyncGenerator<const std::string &> same(const std::string &item, int n) { for (int i = 0; i < n; ++i) co_yield item; }
+
+    // reuses one buffer for every slice, as a reader filling a read buffer would
+    AsyncGenerator<std::span<const int>> slices(int total, int size) {
+        std::vector<int> buffer(size);
+        for (int base = 0; base < total; base += size) {
+            const auto n = std::min(size, total - base);
+            std::iota(buffer.begin(), buffer.begin() + n, base);
+            co_yield std::span<const int>(buffer.data(), n);
+        }
+    }
+
+    BufferedGenerator<int, 8> count_buffered(IExecutor *executor, int n) {
+        co_await SwitchTo(executor);
+        for (int i = 0; i < n; ++i) co_yield int(i);
+    }
+
+    BufferedGenerator<int> fail_buffered() {
+        co_yield 1;
+        throw std::runtime_error("");
+    }
+}
+
+TEST(kls_coroutine, AsyncGenerator) {
+    using namespace kls::coroutine;
+    const auto sum = run_blocking([&]() -> ValueAsync<int> {
+        int result = 0;
+        auto gen = count(100);
+        while (co_await gen.forward()) result += gen.next();
+        co_return result;
+    });
+    EXPECT_EQ(sum, 4950);
+}
+
+TEST(kls_coroutine, BufferedGenerator) {
+    using namespace kls::coroutine;
+    auto executor = CreateSingleThreadExecutor();
+    const auto sum = run_blocking([&]() -> ValueAsync<long> {
+        long result = 0;
+        int expected = 0;
+        auto gen = count_buffered(executor.get(), 100000);
+        while (co_await gen.forward()) {
+            const auto v = gen.next();
+            EXPECT_EQ(v, expected++);
+            result += v;
+        }
+        co_return result;
+    });
+    EXPECT_EQ(sum, 99999l * 100000 / 2);
+}
+
+TEST(kls_coroutine, BufferedGeneratorFailure) {
+    using namespace kls::coroutine;
+    EXPECT_ANY_THROW(run_blocking([&]() -> ValueAsync<> {
+        auto gen = fail_buffered();
+        while (co_await gen.forward()) (void) gen.next();
+    }));
+}
+
+TEST(kls_coroutine, AsyncGeneratorBorrowed) {
+    using namespace kls::coroutine;
+    const std::string item(64, 'x');
+    const auto count = run_blocking([&]() -> ValueAsync<int> {
+        int result = 0;
+        auto gen = same(item, 10);
+        while (co_await gen.forward()) result += (&gen.next() == &item);
+        co_return result;
+    });
+    EXPECT_EQ(count, 10);
+    const auto sum = run_blocking([&]() -> ValueAsync<long> {
+        long result = 0;
+        auto gen = slices(1000, 64);
+        while (co_await gen.forward()) for (const auto v: gen.next()) result += v;
+        co_return result;
+    });
+    EXPECT_EQ(sum, 999l * 1000 / 2);
+}
@@ -0,0 +1,108 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <thread>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Latency.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    ValueAsync<int> produce(IExecutor *executor) {
+        co_await SwitchTo(executor);
+        co_return 42;
+    }
+
+    ValueAsync<void> start_recording(IExecutor *executor) {
+        co_await SwitchTo(executor);
+        executor->latency();
+    }
+
+    // awaits a task finishing on another executor, the trigger then queues the waiter back onto its own
+    ValueAsync<void> consume(IExecutor *home, IExecutor *other, int &got) {
+        co_await SwitchTo(home);
+        got = co_await produce(other);
+    }
+}
+
+TEST(kls_coroutine, LatencyHistogramPercentiles) {
+    using namespace std::chrono_literals;
+    LatencyHistogram histogram{};
+    EXPECT_EQ(histogram.p99(), 0ns);
+    for (int i = 1; i <= 1000; ++i) histogram.record(std::chrono::microseconds(i));
+    EXPECT_EQ(histogram.count(), 1000u);
+    EXPECT_EQ(histogram.max(), 1000us);
+    EXPECT_EQ(histogram.mean(), 500500ns);
+    const auto near = [](std::chrono::nanoseconds value, std::chrono::nanoseconds expect) {
+        return value >= expect && value <= expect + expect / 32;
+    };
+    EXPECT_TRUE(near(histogram.p50(), 500us));
+    EXPECT_TRUE(near(histogram.p99(), 990us));
+    EXPECT_TRUE(near(histogram.p999(), 999us));
+    LatencyHistogram other{};
+    other.record(1h);
+    histogram.merge(other);
+    EXPECT_EQ(histogram.count(), 1001u);
+    EXPECT_GE(histogram.percentile(1.0), 1h);
+    EXPECT_TRUE(near(histogram.p50(), 501us));
+}
+
+TEST(kls_coroutine, LatencyWakeAfterDependency) {
+    using namespace std::chrono_literals;
+    ManualDrainExecutor home{}, other{};
+    auto &recorder = home.executor()->latency();
+    EXPECT_EQ(home.executor()->latency_recorder(), &recorder);
+    int got = 0;
+    consume(home.executor(), other.executor(), got);
+    home.drain_once();
+    other.drain_once();
+    std::this_thread::sleep_for(2ms);
+    home.drain_once();
+    EXPECT_EQ(got, 42);
+    const auto kept = recorder.collect(false);
+    EXPECT_EQ(kept.run.count(), 2u);
+    EXPECT_EQ(kept.wait.count(), 2u);
+    const auto report = recorder.collect();
+    EXPECT_EQ(report.wait.count(), 2u);
+    ASSERT_EQ(report.wake.count(), 1u);
+    EXPECT_GE(report.wake.p50(), 2ms);
+    EXPECT_GE(report.wait.max(), 2ms);
+    EXPECT_EQ(recorder.collect().run.count(), 0u);
+    recorder.enable(false);
+    consume(home.executor(), other.executor(), got);
+    home.drain_once();
+    other.drain_once();
+    home.drain_once();
+    EXPECT_EQ(recorder.collect().run.count(), 0u);
+}
+
+TEST(kls_coroutine, LatencyRecordsRunThatEnabledIt) {
+    ManualDrainExecutor home{}, other{};
+    // keeps enqueues stamped, so the run below goes through the recording path
+    other.executor()->latency();
+    start_recording(home.executor());
+    home.drain_once();
+    const auto recorder = home.executor()->latency_recorder();
+    ASSERT_NE(recorder, nullptr);
+    EXPECT_EQ(recorder->collect().run.count(), 1u);
+}
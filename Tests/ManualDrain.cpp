@@ -0,0 +1,73 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <gtest/gtest.h>
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    // every step goes back through the queue, so each one is a separate task
+    ValueAsync<void> steps(IExecutor *executor, int n, int &counter) {
+        co_await SwitchTo(executor);
+        for (int i = 0; i < n; ++i) {
+            ++counter;
+            co_await Redispatch{};
+        }
+    }
+}
+
+TEST(kls_coroutine, ManualDrainCount) {
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+    ManualDrainExecutor main{};
+    int counter = 0;
+    for (int i = 0; i < 3; ++i) steps(main.executor(), 10, counter);
+    const auto first = main.drain_n(5);
+    EXPECT_EQ(first.ran, 5);
+    EXPECT_TRUE(first.remaining);
+    EXPECT_EQ(counter, 5);
+    EXPECT_EQ(this_executor(), nullptr);
+    EXPECT_EQ(main.drain_for(0ms).ran, 0);
+    std::size_t total = first.ran;
+    for (;;) {
+        const auto step = main.drain_n(7);
+        total += step.ran;
+        if (!step.remaining) break;
+    }
+    EXPECT_EQ(counter, 30);
+    EXPECT_EQ(total, 33);
+}
+
+TEST(kls_coroutine, ManualDrainBudget) {
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+    ManualDrainExecutor main{};
+    int counter = 0;
+    steps(main.executor(), 1000000, counter);
+    const auto result = main.drain_for(2ms);
+    EXPECT_GT(result.ran, 0);
+    EXPECT_TRUE(result.remaining);
+    EXPECT_EQ(this_executor(), nullptr);
+    while (main.drain_until(std::chrono::steady_clock::now() + 10ms).remaining);
+    EXPECT_EQ(counter, 1000000);
+}
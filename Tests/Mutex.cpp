@@ -0,0 +1,172 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Mutex.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    ValueAsync<> increment(IExecutor *executor, Mutex &mutex, int &counter, bool transfer) {
+        co_await SwitchTo(executor);
+        for (int j = 0; j < 1000; ++j) {
+            co_await mutex.lock_async();
+            ++counter;
+            if (transfer) co_await mutex.unlock_async(); else mutex.unlock();
+        }
+    }
+
+    int contend(MutexHandoff handoff, int spin, bool transfer, MutexStatistics &stats) {
+        auto executor = CreateScalingBagExecutor(1, 4, 100);
+        Mutex mutex{handoff, spin};
+        int counter = 0;
+        run_blocking([&]() -> ValueAsync<> {
+            std::vector<ValueAsync<>> tasks{};
+            for (int i = 0; i < 8; ++i) tasks.push_back(increment(executor.get(), mutex, counter, transfer));
+            co_await await_all(std::move(tasks));
+        });
+        stats = mutex.statistics();
+        return counter;
+    }
+
+    ValueAsync<> lock_once(IExecutor *executor, Mutex &mutex, bool &locked) {
+        co_await SwitchTo(executor);
+        co_await mutex.lock_async();
+        locked = true;
+        mutex.unlock();
+    }
+
+    ValueAsync<> lock_cancellable(IExecutor *executor, Mutex &mutex, CancellationToken token, int &outcome) {
+        co_await SwitchTo(executor);
+        try {
+            const auto lock = co_await mutex.scoped_lock_async(std::move(token));
+            outcome = 1;
+        }
+        catch (const OperationCancelled &) { outcome = -1; }
+    }
+
+    ValueAsync<> cancel_after_grant(IExecutor *executor, Mutex &mutex, CancellationSource &source, int &outcome) {
+        co_await SwitchTo(executor);
+        // the awaiter outlives the grant, a stop requested now still finds its callback registered
+        auto acquire = mutex.scoped_lock_async(source.token());
+        const auto lock = co_await acquire;
+        std::thread([&source]() { source.cancel(); }).join();
+        outcome = 1;
+    }
+}
+
+TEST(kls_coroutine, MutexEnqueueHandoff) {
+    using namespace kls::coroutine;
+    MutexStatistics stats{};
+    EXPECT_EQ(contend(MutexHandoff::Enqueue, 0, false, stats), 8000);
+    EXPECT_EQ(stats.acquisitions, 8000u);
+    EXPECT_LE(stats.contended, stats.acquisitions);
+}
+
+TEST(kls_coroutine, MutexInlineHandoff) {
+    using namespace kls::coroutine;
+    MutexStatistics stats{};
+    EXPECT_EQ(contend(MutexHandoff::Inline, 0, false, stats), 8000);
+    EXPECT_EQ(contend(MutexHandoff::Inline, 0, true, stats), 8000);
+    EXPECT_EQ(stats.acquisitions, 8000u);
+}
+
+TEST(kls_coroutine, MutexBargingSpin) {
+    using namespace kls::coroutine;
+    MutexStatistics stats{};
+    EXPECT_EQ(contend(MutexHandoff::Barging, 64, false, stats), 8000);
+    EXPECT_EQ(stats.acquisitions, 8000u);
+}
+
+TEST(kls_coroutine, MutexTryLockStatistics) {
+    using namespace kls::coroutine;
+    Mutex mutex{};
+    ASSERT_TRUE(mutex.try_lock());
+    ASSERT_FALSE(mutex.try_lock());
+    mutex.unlock();
+    const auto stats = mutex.statistics();
+    EXPECT_EQ(stats.acquisitions, 1u);
+    EXPECT_EQ(stats.contended, 0u);
+}
+
+TEST(kls_coroutine, MutexSpinCountsAsContended) {
+    using namespace kls::coroutine;
+    ManualDrainExecutor executor{};
+    Mutex mutex{MutexHandoff::Barging, 4};
+    ASSERT_TRUE(mutex.try_lock());
+    bool locked = false;
+    lock_once(executor.executor(), mutex, locked);
+    executor.drain_once();
+    EXPECT_FALSE(locked);
+    mutex.unlock();
+    executor.drain_once();
+    EXPECT_TRUE(locked);
+    const auto stats = mutex.statistics();
+    EXPECT_EQ(stats.acquisitions, 2u);
+    EXPECT_EQ(stats.contended, 1u);
+}
+
+TEST(kls_coroutine, MutexCancelWait) {
+    using namespace kls::coroutine;
+    ManualDrainExecutor executor{};
+    Mutex mutex{};
+    ASSERT_TRUE(mutex.try_lock());
+    CancellationSource first{}, second{};
+    int a = 0, b = 0;
+    bool locked = false;
+    lock_cancellable(executor.executor(), mutex, first.token(), a);
+    lock_cancellable(executor.executor(), mutex, second.token(), b);
+    lock_once(executor.executor(), mutex, locked);
+    executor.drain_once();
+    first.cancel();
+    executor.drain_once();
+    EXPECT_EQ(a, -1);
+    EXPECT_EQ(b, 0);
+    // the entry of the cancelled wait is skipped, and the lock goes to the next one in line
+    mutex.unlock();
+    executor.drain_once();
+    EXPECT_EQ(b, 1);
+    EXPECT_TRUE(locked);
+    EXPECT_TRUE(mutex.try_lock());
+    mutex.unlock();
+}
+
+TEST(kls_coroutine, MutexCancelAfterGrant) {
+    using namespace kls::coroutine;
+    ManualDrainExecutor executor{};
+    Mutex mutex{};
+    ASSERT_TRUE(mutex.try_lock());
+    CancellationSource source{};
+    int outcome = 0;
+    cancel_after_grant(executor.executor(), mutex, source, outcome);
+    executor.drain_once();
+    mutex.unlock();
+    executor.drain_once();
+    EXPECT_EQ(outcome, 1);
+    EXPECT_TRUE(source.cancelled());
+    EXPECT_TRUE(mutex.try_lock());
+    mutex.unlock();
+}
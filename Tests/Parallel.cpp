@@ -0,0 +1,105 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Parallel.h"
+#include "kls/coroutine/Blocking.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    AsyncGenerator<int> count(int n) { for (int i = 0; i < n; ++i) co_yield i; }
+
+    // later items finish sooner, so anything in order has gone through the reorder window
+    int slow_square(int v) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100 * (7 - v % 8)));
+        return v * v;
+    }
+
+    ValueAsync<std::vector<int>> collect_map(IExecutor *executor, int n, bool ordered) {
+        co_await SwitchTo(executor);
+        std::vector<int> out;
+        auto gen = parallel_map(count(n), slow_square, 4, ordered);
+        while (co_await gen.forward()) out.push_back(gen.next());
+        co_return out;
+    }
+}
+
+TEST(kls_coroutine, ParallelFor) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingBagExecutor(1, 4, 100);
+    std::vector<int> data(10000, 1);
+    run_blocking([&]() -> ValueAsync<> {
+        co_await SwitchTo(executor.get());
+        co_await parallel_for(data, 64, [](int &x) { x *= 2; });
+    });
+    EXPECT_EQ(std::accumulate(data.begin(), data.end(), 0), 20000);
+}
+
+TEST(kls_coroutine, ParallelTransformReduce) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingBagExecutor(1, 4, 100);
+    std::vector<long> data(10000);
+    std::iota(data.begin(), data.end(), 0);
+    std::vector<long> doubled(data.size());
+    const auto sum = run_blocking([&]() -> ValueAsync<long> {
+        co_await SwitchTo(executor.get());
+        co_await parallel_transform(data, doubled.begin(), 128, [](long x) { return x * 2; });
+        co_return co_await parallel_reduce(doubled, 5l, std::plus<>{}, 100);
+    });
+    EXPECT_EQ(sum, 5 + 2 * (9999l * 10000 / 2));
+}
+
+TEST(kls_coroutine, ParallelForFailure) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingBagExecutor(1, 4, 100);
+    std::vector<int> data(1000, 1);
+    EXPECT_ANY_THROW(run_blocking([&]() -> ValueAsync<> {
+        co_await SwitchTo(executor.get());
+        co_await parallel_for(data, 16, [](int &x) { if (x == 1) throw std::runtime_error(""); });
+    }));
+}
+
+TEST(kls_coroutine, ParallelMap) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingFIFOExecutor(1, 4, 100);
+    std::vector<int> expected(200);
+    for (int i = 0; i < 200; ++i) expected[i] = i * i;
+    EXPECT_EQ(run_blocking([&]() { return collect_map(executor.get(), 200, true); }), expected);
+    auto unordered = run_blocking([&]() { return collect_map(executor.get(), 200, false); });
+    std::sort(unordered.begin(), unordered.end());
+    EXPECT_EQ(unordered, expected);
+}
+
+TEST(kls_coroutine, ParallelMapFailure) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingFIFOExecutor(1, 4, 100);
+    EXPECT_ANY_THROW(run_blocking([&]() -> ValueAsync<> {
+        co_await SwitchTo(executor.get());
+        auto gen = parallel_map(count(100), [](int v) { return v == 50 ? throw std::runtime_error("") : v; }, 8);
+        while (co_await gen.forward()) (void) gen.next();
+    }));
+}
@@ -0,0 +1,175 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Pipeline.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    AsyncGenerator<int> naturals() { for (int i = 1;; ++i) co_yield i; }
+
+    AsyncGenerator<std::string> words(int n) { for (int i = 0; i < n; ++i) co_yield std::string(32, char('a' + i)); }
+
+    AsyncGenerator<const std::string &> refs(const std::vector<std::string> &items) {
+        for (auto &item: items) co_yield item;
+    }
+
+    AsyncGenerator<int> range_on(IExecutor *executor, int begin, int end) {
+        co_await SwitchTo(executor);
+        for (int i = begin; i < end; ++i) co_yield int(i);
+    }
+
+    // the frame holds on to 'alive' until it is destroyed
+    AsyncGenerator<int> counted(IExecutor *executor, int begin, int end, std::shared_ptr<int> alive) {
+        co_await SwitchTo(executor);
+        for (int i = begin; i < end; ++i) co_yield int(i);
+    }
+
+    // takes one item and lets go, with the producer queued to run on 'home', where it was created. with 'hold'
+    // the consumer waits for the next item first, so the producer is parked on it when the pipeline goes away
+    ValueAsync<void> take_one(IExecutor *home, IExecutor *source, bool hold, std::shared_ptr<int> alive, int &got) {
+        co_await SwitchTo(home);
+        auto pipe = counted(source, 0, 100, alive) | map([alive](int v) { return v * 2; });
+        if (co_await pipe.forward()) got = pipe.next();
+        if (hold) (void) co_await pipe.forward();
+    }
+
+    ValueAsync<void> merge_one(IExecutor *home, IExecutor *source, std::shared_ptr<int> alive, int &got) {
+        co_await SwitchTo(home);
+        auto gen = merge(counted(source, 0, 100, alive), counted(source, 100, 200, alive));
+        if (co_await gen.forward()) got = gen.next();
+    }
+
+    AsyncGenerator<int> fail_after(int n) {
+        for (int i = 0; i < n; ++i) co_yield int(i);
+        throw std::runtime_error("");
+    }
+}
+
+TEST(kls_coroutine, PipelineMapFilterTake) {
+    using namespace kls::coroutine;
+    const auto result = run_blocking([]() -> ValueAsync<std::vector<int>> {
+        std::vector<int> out;
+        auto pipe = naturals() | filter([](int v) { return v % 2 == 0; }) | map([](int v) { return v * v; }) | take(4);
+        while (co_await pipe.forward()) out.push_back(pipe.next());
+        co_return out;
+    });
+    EXPECT_EQ(result, (std::vector<int>{4, 16, 36, 64}));
+}
+
+TEST(kls_coroutine, PipelineTakeNone) {
+    using namespace kls::coroutine;
+    const auto result = run_blocking([]() -> ValueAsync<std::vector<int>> {
+        std::vector<int> out;
+        auto pipe = naturals() | take(0);
+        while (co_await pipe.forward()) out.push_back(pipe.next());
+        co_return out;
+    });
+    EXPECT_TRUE(result.empty());
+}
+
+TEST(kls_coroutine, PipelineChunk) {
+    using namespace kls::coroutine;
+    const auto result = run_blocking([]() -> ValueAsync<std::vector<std::size_t>> {
+        std::vector<std::size_t> sizes;
+        auto pipe = words(10) | chunk(4);
+        while (co_await pipe.forward()) {
+            const auto group = pipe.next();
+            for (auto &word: group) EXPECT_EQ(word.size(), 32);
+            sizes.push_back(group.size());
+        }
+        co_return sizes;
+    });
+    EXPECT_EQ(result, (std::vector<std::size_t>{4, 4, 2}));
+}
+
+TEST(kls_coroutine, PipelineFailure) {
+    using namespace kls::coroutine;
+    EXPECT_ANY_THROW(run_blocking([]() -> ValueAsync<> {
+        auto pipe = fail_after(3) | map([](int v) { return v + 1; });
+        while (co_await pipe.forward()) (void) pipe.next();
+    }));
+    EXPECT_ANY_THROW(run_blocking([]() -> ValueAsync<> {
+        auto pipe = naturals() | map([](int v) { return v < 5 ? v : throw std::runtime_error(""); });
+        while (co_await pipe.forward()) (void) pipe.next();
+    }));
+}
+
+TEST(kls_coroutine, Merge) {
+    using namespace kls::coroutine;
+    auto executor = CreateScalingFIFOExecutor(1, 4, 100);
+    auto result = run_blocking([&]() -> ValueAsync<std::vector<int>> {
+        std::vector<int> out;
+        auto gen = merge(range_on(executor.get(), 0, 1000), range_on(executor.get(), 1000, 2000), range_on(executor.get(), 2000, 3000));
+        while (co_await gen.forward()) out.push_back(gen.next());
+        co_return out;
+    });
+    std::sort(result.begin(), result.end());
+    ASSERT_EQ(result.size(), 3000);
+    for (int i = 0; i < 3000; ++i) EXPECT_EQ(result[i], i);
+}
+
+TEST(kls_coroutine, PipelineBorrowed) {
+    using namespace kls::coroutine;
+    const std::vector<std::string> items{"a", "bb", "ccc", "dddd"};
+    const auto result = run_blocking([&]() -> ValueAsync<std::vector<const std::string *>> {
+        std::vector<const std::string *> out;
+        auto pipe = refs(items) | filter([](const std::string &v) { return v.size() % 2 == 0; });
+        while (co_await pipe.forward()) out.push_back(&pipe.next());
+        co_return out;
+    });
+    EXPECT_EQ(result, (std::vector<const std::string *>{&items[1], &items[3]}));
+}
+
+TEST(kls_coroutine, PipelineAbandon) {
+    using namespace kls::coroutine;
+    for (const bool hold: {false, true}) {
+        ManualDrainExecutor home{}, source{};
+        auto alive = std::make_shared<int>();
+        int got = -1;
+        take_one(home.executor(), source.executor(), hold, alive, got);
+        home.drain_once();
+        source.drain_once();
+        home.drain_once();
+        EXPECT_EQ(got, 0);
+        EXPECT_EQ(alive.use_count(), 1);
+    }
+}
+
+TEST(kls_coroutine, MergeAbandon) {
+    using namespace kls::coroutine;
+    ManualDrainExecutor home{}, source{};
+    auto alive = std::make_shared<int>();
+    int got = -1;
+    merge_one(home.executor(), source.executor(), alive, got);
+    home.drain_once();
+    source.drain_once();
+    home.drain_once();
+    EXPECT_TRUE(got == 0 || got == 100);
+    EXPECT_EQ(alive.use_count(), 1);
+}
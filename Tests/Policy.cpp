@@ -0,0 +1,86 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <latch>
+#include <atomic>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/PolicyExecutor.h"
+
+namespace {
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    using SpinningPool = PolicyExecutor<detail::FifoQueue, SpinIdle<50>, FixedScaling>;
+
+    ValueAsync<void> bounce(SpinningPool *pool, int hops, std::atomic_int &strays, std::latch &done) {
+        for (int i = 0; i < hops; ++i) {
+            co_await SwitchTo(pool);
+            if (this_executor() != pool) strays.fetch_add(1);
+        }
+        done.count_down();
+    }
+
+    // links like the FIFO queue, and keeps the deadline of the enqueuing thread as a deadline queue would read it
+    template<class Task>
+    struct DeadlineProbeQueue : detail::FifoQueue<Task> {
+        static constexpr bool ByDeadline = true;
+        static inline std::atomic<Deadline> seen{};
+
+        void Link(TaskNode *node) noexcept {
+            seen = this_deadline();
+            detail::FifoQueue<Task>::Link(node);
+        }
+    };
+
+    ValueAsync<int> answer(IExecutor *executor) {
+        co_await SwitchTo(executor);
+        co_return 42;
+    }
+}
+
+TEST(kls_coroutine, PolicyExecutorTypedSwitch) {
+    SpinningPool pool{{2, 2, 0ms}};
+    std::atomic_int strays{0};
+    std::latch done{16};
+    for (int i = 0; i < 16; ++i) bounce(&pool, 100, strays, done);
+    done.wait();
+    EXPECT_EQ(strays, 0);
+    EXPECT_EQ(pool.threads(), 2);
+}
+
+TEST(kls_coroutine, PolicyExecutorTypedConfigure) {
+    PolicyExecutor<> pool{{1, 4, 10ms}};
+    auto other = CreateSingleThreadExecutor();
+    const auto landed = run_blocking([&]() -> ValueAsync<bool> {
+        const auto value = co_await answer(other.get()).configure<PolicyExecutor<>>(&pool);
+        co_return value == 42 && this_executor() == &pool;
+    });
+    EXPECT_TRUE(landed);
+}
+
+TEST(kls_coroutine, PolicyExecutorTypedSwitchKeepsDeadline) {
+    PolicyExecutor<DeadlineProbeQueue, ParkIdle, FixedScaling> pool{{1, 1, 0ms}};
+    const auto deadline = std::chrono::steady_clock::now() + 1h;
+    run_blocking([&]() -> ValueAsync<void> { co_await SwitchTo(&pool, deadline); });
+    EXPECT_EQ(DeadlineProbeQueue<void *>::seen.load(), deadline);
+}
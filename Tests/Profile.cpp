@@ -0,0 +1,111 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <latch>
+#include <algorithm>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Profile.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    TaskTag gSpin{"spin"}, gRetagged{"retagged"};
+
+    ValueAsync<void> spin(IExecutor *executor, int hops, bool &kept, std::latch &done) {
+        for (int i = 0; i < hops; ++i) {
+            co_await SwitchTo(executor);
+            kept = kept && this_tag() == &gSpin;
+            for (auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(200);;) {
+                if (std::chrono::steady_clock::now() >= until) break;
+            }
+        }
+        co_await SwitchTo(executor, gRetagged);
+        kept = kept && this_tag() == &gRetagged;
+        done.count_down();
+    }
+
+    const TaskProfile *find(const std::vector<TaskProfile> &report, const TaskTag &tag) {
+        const auto it = std::find_if(report.begin(), report.end(), [&](auto &line) { return line.tag == &tag; });
+        return it == report.end() ? nullptr : &*it;
+    }
+}
+
+TEST(kls_coroutine, ProfileByTag) {
+    auto executor = CreateSingleThreadExecutor();
+    set_profiling(true);
+    reset_profile();
+    bool kept = true;
+    std::latch done{1};
+    {
+        TagScope scope{gSpin};
+        spin(executor.get(), 10, kept, done);
+    }
+    EXPECT_EQ(this_tag(), nullptr);
+    done.wait();
+    // the last run is accounted only once it returns to the executor, which is done with it when joined
+    executor.reset();
+    set_profiling(false);
+    EXPECT_TRUE(kept);
+    const auto report = profile_report();
+    const auto line = find(report, gSpin);
+    ASSERT_NE(line, nullptr);
+    EXPECT_EQ(line->resumes, 10u);
+    EXPECT_GE(line->cpu, std::chrono::milliseconds(1));
+    const auto retagged = find(report, gRetagged);
+    ASSERT_NE(retagged, nullptr);
+    EXPECT_EQ(retagged->resumes, 1u);
+    EXPECT_STREQ(gSpin.name(), "spin");
+}
+
+TEST(kls_coroutine, ProfileDropsDestroyedTag) {
+    set_profiling(true);
+    reset_profile();
+    const TaskTag *gone;
+    {
+        TaskTag scoped{"scoped"};
+        gone = &scoped;
+        auto executor = CreateSingleThreadExecutor();
+        run_blocking([&]() -> ValueAsync<void> { co_await SwitchTo(executor.get(), scoped); });
+        executor.reset();
+        ASSERT_NE(find(profile_report(), scoped), nullptr);
+    }
+    set_profiling(false);
+    const auto report = profile_report();
+    EXPECT_TRUE(std::none_of(report.begin(), report.end(), [&](auto &line) { return line.tag == gone; }));
+}
+
+TEST(kls_coroutine, ProfileTagSurvivesBareQueues) {
+    // bag and deadline queues hold bare handles, shards pass handles to each other through rings
+    const auto bag = CreateScalingBagExecutor(1, 2, 10);
+    const auto deadline = CreateScalingDeadlineExecutor(1, 2, 10);
+    const auto shards = CreateShardedExecutor(2, false);
+    std::vector<IExecutor *> hops{bag.get(), deadline.get(), shards->shard(0), shards->shard(1), bag.get()};
+    std::vector<const TaskTag *> seen;
+    {
+        TagScope scope{gSpin};
+        run_blocking([&]() -> ValueAsync<void> {
+            for (const auto executor: hops) co_await SwitchTo(executor), seen.push_back(this_tag());
+        });
+    }
+    EXPECT_EQ(seen, std::vector<const TaskTag *>(hops.size(), &gSpin));
+}
@@ -0,0 +1,189 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <mutex>
+#include <latch>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Scaling.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    // grows whenever asked and retires whenever a thread idles, recording every event
+    class EagerPolicy : public IScalingPolicy {
+    public:
+        EagerPolicy() noexcept: IScalingPolicy(
+                static_cast<FnDecide>(&EagerPolicy::DecideImpl), static_cast<FnRecord>(&EagerPolicy::RecordImpl)
+        ) {}
+
+        std::vector<ScalingEvent> events() {
+            std::lock_guard lk{mLock};
+            return mEvents;
+        }
+
+    private:
+        std::mutex mLock;
+        std::vector<ScalingEvent> mEvents;
+
+        ScalingDecision DecideImpl(const ScalingSample &sample) noexcept {
+            return sample.reason == ScalingSample::Reason::Idle ? ScalingDecision::Retire : ScalingDecision::Spawn;
+        }
+
+        void RecordImpl(const ScalingEvent &event) noexcept {
+            std::lock_guard lk{mLock};
+            mEvents.push_back(event);
+        }
+    };
+
+    // never asks for a thread, so whatever the pool spawns it does on its own
+    class HoldPolicy : public IScalingPolicy {
+    public:
+        HoldPolicy() noexcept: IScalingPolicy(
+                static_cast<FnDecide>(&HoldPolicy::DecideImpl), static_cast<FnRecord>(&HoldPolicy::RecordImpl)
+        ) {}
+
+    private:
+        ScalingDecision DecideImpl(const ScalingSample &) noexcept { return ScalingDecision::Hold; }
+
+        void RecordImpl(const ScalingEvent &) noexcept {}
+    };
+
+    template<class Fn>
+    bool eventually(Fn &&fn, std::chrono::milliseconds timeout = 3s) {
+        for (const auto end = std::chrono::steady_clock::now() + timeout; !fn();) {
+            if (std::chrono::steady_clock::now() > end) return false;
+            std::this_thread::sleep_for(1ms);
+        }
+        return true;
+    }
+
+    ValueAsync<void> hold(IExecutor *executor, std::atomic_int &started, std::latch &gate) {
+        co_await SwitchTo(executor);
+        started.fetch_add(1);
+        gate.wait();
+    }
+
+    ValueAsync<void> flag(IExecutor *executor, std::atomic_bool &ran) {
+        co_await SwitchTo(executor);
+        ran = true;
+    }
+
+    // queues a task and then waits for it without a blocking section, so the only worker is stuck on it
+    ValueAsync<void> wait_on_queued(IExecutor *executor, std::atomic_bool &ran, bool &seen) {
+        co_await SwitchTo(executor);
+        flag(executor, ran);
+        seen = eventually([&] { return ran.load(); });
+    }
+
+    ValueAsync<void> nap(IExecutor *executor, std::latch &done) {
+        co_await SwitchTo(executor);
+        std::this_thread::sleep_for(1ms);
+        done.count_down();
+    }
+
+    // queues a burst from the only worker, which stays busy until all of it is queued
+    ValueAsync<void> burst(IExecutor *executor, int count, std::latch &done) {
+        co_await SwitchTo(executor);
+        for (int i = 0; i < count; ++i) nap(executor, done);
+    }
+}
+
+TEST(kls_coroutine, ScalingPolicyDecides) {
+    using namespace kls::coroutine;
+    auto policy = std::make_shared<EagerPolicy>();
+    auto control = CreateScalingFIFOExecutor({1, 4, 20ms}, policy);
+    std::atomic_int started{0};
+    std::latch gate{1};
+    // every task holds its thread, so each one needs a thread of its own
+    for (int i = 0; i < 4; ++i) {
+        std::this_thread::sleep_for(5ms);
+        hold(control->executor(), started, gate);
+        ASSERT_TRUE(eventually([&] { return started.load() == i + 1; }));
+    }
+    EXPECT_EQ(control->threads(), 4);
+    gate.count_down();
+    ASSERT_TRUE(eventually([&] { return control->threads() == 1; }));
+    int spawned = 0, retired = 0;
+    for (auto &&event: policy->events()) {
+        (event.decision == ScalingDecision::Spawn ? spawned : retired) += 1;
+        EXPECT_GE(event.threads, 1);
+        EXPECT_LE(event.threads, 4);
+    }
+    EXPECT_EQ(spawned, 4);
+    EXPECT_EQ(retired, 3);
+}
+
+TEST(kls_coroutine, ScalingLimitsAtRuntime) {
+    using namespace kls::coroutine;
+    auto control = CreateScalingBagExecutor({1, 4, 20ms});
+    control->set_limits({3, 4, 20ms});
+    run_blocking([&]() -> ValueAsync<void> { co_await SwitchTo(control->executor()); });
+    EXPECT_EQ(control->threads(), 3);
+    control->set_limits({1, 1, 10ms});
+    EXPECT_EQ(control->limits().max, 1);
+    EXPECT_EQ(control->limits().linger, 10ms);
+    EXPECT_TRUE(eventually([&] { return control->threads() == 1; }));
+    control->set_limits({2, 0, 10ms});
+    EXPECT_EQ(control->limits().max, 2);
+}
+
+TEST(kls_coroutine, ScalingAdaptiveGrowsUnderBacklog) {
+    using namespace kls::coroutine;
+    std::atomic_int peak{0};
+    AdaptiveScalingPolicy::Options options{};
+    options.sink = [&](const ScalingEvent &event) { peak = std::max(peak.load(), event.threads); };
+    auto policy = std::make_shared<AdaptiveScalingPolicy>(options);
+    auto control = CreateScalingFIFOExecutor({1, 4, 20ms}, policy);
+    constexpr int count = 256;
+    std::latch done{count};
+    for (int i = 0; i < count; ++i) nap(control->executor(), done);
+    done.wait();
+    EXPECT_GT(peak.load(), 1);
+    EXPECT_GE(policy->spawned(), 2u);
+    EXPECT_TRUE(eventually([&] { return control->threads() == 1; }));
+    EXPECT_EQ(policy->spawned(), policy->retired() + 1);
+}
+
+TEST(kls_coroutine, ScalingRunsWorkQueuedBehindBlockedThreads) {
+    using namespace kls::coroutine;
+    auto control = CreateScalingFIFOExecutor({1, 2, 20ms}, std::make_shared<HoldPolicy>());
+    std::atomic_bool ran{false};
+    bool seen = false;
+    run_blocking([&]() { return wait_on_queued(control->executor(), ran, seen); });
+    EXPECT_TRUE(seen);
+}
+
+TEST(kls_coroutine, ScalingBurstLeavesGrowthToPolicy) {
+    using namespace kls::coroutine;
+    auto control = CreateScalingFIFOExecutor({1, 8, 20ms}, std::make_shared<HoldPolicy>());
+    constexpr int count = 32;
+    std::latch done{count};
+    burst(control->executor(), count, done);
+    done.wait();
+    // the pool saw no thread parked on every enqueue, but nothing stalled and the policy held
+    EXPECT_EQ(control->threads(), 1);
+}
@@ -0,0 +1,124 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <latch>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    ValueAsync<void> bump(IExecutor *target, int &counter, std::latch &done) {
+        co_await SwitchTo(target);
+        ++counter; // only ever touched on the owning shard
+        done.count_down();
+    }
+
+    // sends more than a ring holds from one shard at once, so the full-ring fallback is taken as well
+    ValueAsync<void> fan_out(ShardedExecutor &executor, int from, int each, std::vector<int> &counters, std::latch &done) {
+        co_await SwitchTo(executor.shard(from));
+        for (int i = 0; i < each; ++i) {
+            const auto to = i % executor.size();
+            bump(executor.shard(to), counters[to * 16], done);
+        }
+    }
+
+    ValueAsync<void> record(IExecutor *target, int i, std::vector<int> &order, std::latch &done) {
+        co_await SwitchTo(target);
+        // holds the receiver up so the sender is sure to overflow the ring
+        if (i == 0) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        order.push_back(i);
+        done.count_down();
+    }
+
+    // overflows the ring to one shard several times over, with the receiver collecting in between
+    ValueAsync<void> burst(ShardedExecutor &executor, int n, std::vector<int> &order, std::latch &done) {
+        co_await SwitchTo(executor.shard(0));
+        for (int i = 0; i < n; ++i) {
+            record(executor.shard(1), i, order, done);
+            if (i % 97 == 0) std::this_thread::yield();
+        }
+    }
+
+    // keeps its shard busy past the point the destructor stopped the other one, then sends it more work
+    ValueAsync<void> late(ShardedExecutor &executor, std::atomic_int &ran) {
+        co_await SwitchTo(executor.shard(1));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        co_await SwitchTo(executor.shard(0));
+        ++ran;
+    }
+}
+
+TEST(kls_coroutine, ShardedRouting) {
+    using namespace kls::coroutine;
+    auto executor = CreateShardedExecutor(4);
+    EXPECT_EQ(this_shard(), -1);
+    const auto hops = run_blocking([&]() -> ValueAsync<int> {
+        int hops = 0;
+        for (int i = 0; i < 1000; ++i) {
+            const auto to = (i * 7) % executor->size();
+            co_await SwitchTo(executor->shard(to));
+            if (this_shard() == to && this_executor() == executor->shard(to)) ++hops;
+        }
+        co_return hops;
+    });
+    EXPECT_EQ(hops, 1000);
+}
+
+TEST(kls_coroutine, ShardedCrossSubmission) {
+    using namespace kls::coroutine;
+    constexpr int shards = 4, each = 5000;
+    auto executor = CreateShardedExecutor(shards, false);
+    std::vector<int> counters(shards * 16);
+    std::latch done{shards * each};
+    for (int i = 0; i < shards; ++i) fan_out(*executor, i, each, counters, done);
+    done.wait();
+    for (int i = 0; i < shards; ++i) EXPECT_EQ(counters[i * 16], each);
+}
+
+TEST(kls_coroutine, ShardedSpillKeepsOrder) {
+    using namespace kls::coroutine;
+    constexpr int n = 5000;
+    auto executor = CreateShardedExecutor(2, false);
+    std::vector<int> order;
+    std::latch done{n};
+    burst(*executor, n, order, done);
+    done.wait();
+    ASSERT_EQ(order.size(), n);
+    for (int i = 0; i < n; ++i) ASSERT_EQ(order[i], i);
+}
+
+TEST(kls_coroutine, ShardedRunsTailAtShutdown) {
+    using namespace kls::coroutine;
+    std::atomic_int ran{0};
+    {
+        auto executor = CreateShardedExecutor(2, false);
+        run_blocking([&]() -> ValueAsync<void> {
+            co_await SwitchTo(executor->shard(1));
+            late(*executor, ran);
+        });
+    }
+    EXPECT_EQ(ran.load(), 1);
+}
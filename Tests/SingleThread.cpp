@@ -0,0 +1,65 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <thread>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+    using namespace std::chrono_literals;
+
+    ValueAsync<int> ping_pong(IExecutor *a, IExecutor *b, int rounds) {
+        int hops = 0;
+        for (int i = 0; i < rounds; ++i) {
+            co_await SwitchTo(a);
+            if (this_executor() == a) ++hops;
+            co_await SwitchTo(b);
+            if (this_executor() == b) ++hops;
+        }
+        co_return hops;
+    }
+}
+
+TEST(kls_coroutine, SingleThreadBusyPoll) {
+    using namespace kls::coroutine;
+    // 'a' goes first, so that its thread has returned from the last hand-off into 'b' before 'b' is destroyed
+    auto b = CreateSingleThreadExecutor(std::chrono::nanoseconds::max());
+    auto a = CreateSingleThreadExecutor(std::chrono::nanoseconds::max(), 0);
+    EXPECT_EQ(run_blocking([&]() { return ping_pong(a.get(), b.get(), 10000); }), 20000);
+}
+
+TEST(kls_coroutine, SingleThreadPollThenPark) {
+    using namespace kls::coroutine;
+    auto b = CreateSingleThreadExecutor();
+    auto a = CreateSingleThreadExecutor(20us);
+    // pauses longer than the spin make the loop park between hand-offs
+    EXPECT_EQ(run_blocking([&]() -> ValueAsync<int> {
+        int hops = 0;
+        for (int i = 0; i < 20; ++i) {
+            std::this_thread::sleep_for(200us);
+            hops += co_await ping_pong(a.get(), b.get(), 1);
+        }
+        co_return hops;
+    }), 40);
+}
@@ -0,0 +1,124 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <latch>
+#include <stdexcept>
+#include <gtest/gtest.h>
+#include "kls/coroutine/Timed.h"
+#include "kls/coroutine/Event.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+#include "kls/coroutine/TaskGroup.h"
+
+namespace {
+    using namespace std::chrono;
+    using namespace kls::coroutine;
+
+    ValueAsync<> sleeper(CancellationToken token, std::atomic_int &cancelled) {
+        try {
+            co_await wait_for(seconds(30), token);
+        }
+        catch (const OperationCancelled &) {
+            ++cancelled;
+            throw;
+        }
+    }
+
+    ValueAsync<> failing() {
+        co_await wait_for(milliseconds(5));
+        throw std::runtime_error("");
+    }
+
+    ValueAsync<int> answer_on(IExecutor *executor, AsyncEvent &event, std::latch &finished) {
+        co_await SwitchTo(executor);
+        co_await event;
+        finished.count_down();
+        co_return 42;
+    }
+
+    ValueAsync<> cancel_later(CancellationSource &source) {
+        co_await wait_for(milliseconds(5));
+        source.cancel();
+    }
+}
+
+TEST(kls_coroutine, TaskGroupJoin) {
+    using namespace kls::coroutine;
+    std::atomic_int done{0};
+    run_blocking([&]() -> ValueAsync<> {
+        TaskGroup group{};
+        for (int i = 0; i < 10; ++i) {
+            group.spawn([&]() -> ValueAsync<> {
+                co_await wait_for(milliseconds(1));
+                ++done;
+            });
+        }
+        co_await group.join();
+    });
+    EXPECT_EQ(done.load(), 10);
+}
+
+TEST(kls_coroutine, TaskGroupCancelOnFailure) {
+    using namespace kls::coroutine;
+    std::atomic_int cancelled{0};
+    const auto start = steady_clock::now();
+    EXPECT_THROW(run_blocking([&]() -> ValueAsync<> {
+        TaskGroup group{};
+        for (int i = 0; i < 4; ++i) group.spawn([&](CancellationToken token) { return sleeper(token, cancelled); });
+        group.spawn(failing);
+        co_await group.join();
+    }), std::runtime_error);
+    EXPECT_EQ(cancelled.load(), 4);
+    EXPECT_LT(steady_clock::now() - start, seconds(10));
+}
+
+TEST(kls_coroutine, TaskGroupExplicitCancel) {
+    using namespace kls::coroutine;
+    std::atomic_int cancelled{0};
+    CancellationSource parent{};
+    run_blocking([&]() -> ValueAsync<> {
+        TaskGroup group{parent.token()};
+        for (int i = 0; i < 4; ++i) group.spawn([&](CancellationToken token) { return sleeper(token, cancelled); });
+        parent.cancel();
+        group.spawn([&](CancellationToken token) { return sleeper(token, cancelled); });
+        co_await group.join();
+    });
+    EXPECT_EQ(cancelled.load(), 4);
+}
+
+TEST(kls_coroutine, CancellableAwait) {
+    using namespace kls::coroutine;
+    auto executor = CreateSingleThreadExecutor();
+    AsyncEvent event{};
+    CancellationSource source{};
+    std::latch finished{1};
+    EXPECT_THROW(run_blocking([&]() -> ValueAsync<> {
+        auto task = answer_on(executor.get(), event, finished);
+        auto cancel = cancel_later(source);
+        co_await std::move(task).cancellable(source.token());
+    }), OperationCancelled);
+    // the abandoned task still runs to completion, on its own executor
+    event.set();
+    finished.wait();
+}
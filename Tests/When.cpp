@@ -0,0 +1,107 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "kls/coroutine/When.h"
+#include "kls/coroutine/Timed.h"
+#include "kls/coroutine/Blocking.h"
+#include "kls/coroutine/Operation.h"
+
+namespace {
+    using namespace kls::coroutine;
+
+    ValueAsync<int> delayed(int value, int ms) {
+        co_await wait_for(std::chrono::milliseconds(ms));
+        co_return value;
+    }
+
+    ValueAsync<int> on(IExecutor *executor, int value) {
+        co_await SwitchTo(executor);
+        co_return value;
+    }
+
+    ValueAsync<> pick(IExecutor *home, IExecutor *other, std::size_t &index, std::size_t &first, int &value) {
+        co_await SwitchTo(home);
+        auto [i, result] = co_await when_any(on(other, 1), on(other, 2));
+        index = i;
+        EXPECT_EQ(std::get<0>(result), 1);
+        std::vector<ValueAsync<int>> tasks{};
+        for (int k = 0; k < 4; ++k) tasks.push_back(on(other, 10 + k));
+        std::tie(first, value) = co_await when_any(std::move(tasks));
+    }
+
+    ValueAsync<> fail() {
+        co_await wait_for(std::chrono::milliseconds(1));
+        throw std::runtime_error("");
+    }
+}
+
+TEST(kls_coroutine, WhenAllTuple) {
+    using namespace kls::coroutine;
+    run_blocking([&]() -> ValueAsync<> {
+        auto lazy = [](int v) -> LazyAsync<std::string> { co_return std::to_string(v); }(7);
+        auto [a, b, c] = co_await when_all(delayed(1, 5), lazy, delayed(3, 1));
+        EXPECT_EQ(a, 1);
+        EXPECT_EQ(b, "7");
+        EXPECT_EQ(c, 3);
+    });
+}
+
+TEST(kls_coroutine, WhenAllRange) {
+    using namespace kls::coroutine;
+    run_blocking([&]() -> ValueAsync<> {
+        std::vector<ValueAsync<int>> tasks{};
+        for (int i = 0; i < 16; ++i) tasks.push_back(delayed(i, 16 - i));
+        const auto results = co_await when_all(std::move(tasks));
+        EXPECT_EQ(results.size(), 16u);
+        for (int i = 0; i < 16; ++i) EXPECT_EQ(results[i], i);
+    });
+}
+
+TEST(kls_coroutine, WhenAllFailure) {
+    using namespace kls::coroutine;
+    EXPECT_ANY_THROW(run_blocking([&]() -> ValueAsync<> { co_await when_all(delayed(1, 1), fail()); }));
+}
+
+TEST(kls_coroutine, WhenAny) {
+    using namespace kls::coroutine;
+    ManualDrainExecutor children{};
+    std::size_t index = 9, first = 9;
+    int value = 0;
+    {
+        ManualDrainExecutor home{};
+        pick(home.executor(), children.executor(), index, first, value);
+        home.drain_once();
+        // the first child of each call wins, the waits of the others are cancelled from its thread
+        children.drain_n(1);
+        home.drain_once();
+        children.drain_n(3);
+        home.drain_once();
+        EXPECT_EQ(index, 0u);
+        EXPECT_EQ(first, 0u);
+        EXPECT_EQ(value, 10);
+    }
+    // the losers complete after the executor of the caller is gone
+    children.drain_once();
+}
@@ -0,0 +1,69 @@
+/*
+* Copyright (c) 2022 DWVoid and Infinideastudio Team
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include "../Module/WorkStealingQueue.h"
+
+namespace {
+    constexpr int thieves = 3;
+
+    // the owner pushes in bursts that grow the array and pops it back down so it shrinks again, while the
+    // thieves keep stealing all the time. every item has to come out exactly once
+    template<class Steal>
+    void stress(int items, Steal steal) {
+        WorkStealingQueue<int> queue{4};
+        std::vector<std::atomic_int> seen(items);
+        std::atomic_bool done{false};
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thieves; ++i) {
+            threads.emplace_back([&]() {
+                while (!done.load(std::memory_order_relaxed)) steal(queue, seen);
+            });
+        }
+        for (int next = 0; next < items;) {
+            for (int burst = next + 3000; next < items && next < burst; ++next) queue.push(next);
+            for (int i = 0; i < 2500; ++i) if (const auto item = queue.pop(); item) ++seen[*item];
+        }
+        while (const auto item = queue.pop()) ++seen[*item];
+        done = true;
+        for (auto &thread: threads) thread.join();
+        while (const auto item = queue.steal()) ++seen[*item];
+        for (int i = 0; i < items; ++i) ASSERT_EQ(seen[i].load(), 1) << "item " << i;
+        EXPECT_TRUE(queue.empty());
+    }
+}
+
+TEST(kls_coroutine, WorkStealingStress) {
+    stress(200000, [](WorkStealingQueue<int> &queue, std::vector<std::atomic_int> &seen) {
+        if (const auto item = queue.steal(); item) ++seen[*item];
+    });
+}
+
+TEST(kls_coroutine, WorkStealingBatchRacesPop) {
+    stress(200000, [](WorkStealingQueue<int> &queue, std::vector<std::atomic_int> &seen) {
+        // small batches send the thieves back often, so many of them meet the owner popping the last items
+        queue.steal_batch([&](int item) { ++seen[item]; }, 4);
+    });
+}